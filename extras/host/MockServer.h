@@ -0,0 +1,141 @@
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include <Arduino.h>
+#include <vector>
+#include "../../src/ITransportAdapter.h"
+
+// In-process stand-in for the server API, plugged in with setTransport().
+// Requests never leave the process, so benchmarks measure the client alone:
+// encoding, parsing, cache updates and callbacks.
+//
+// The variable list is kept in memory with a revision per entry; GET
+// /api/device/variables (and /api/device/sync) honour If-None-Match with 304
+// or a delta, like a server with delta sync. Writes are acknowledged but not
+// applied, so the server side only changes through set().
+class MockServer : public ITransportAdapter {
+public:
+    struct Counters {
+        unsigned long requests = 0;
+        unsigned long bytesIn = 0;  // request bodies
+        unsigned long bytesOut = 0; // response bodies
+    };
+
+    // type: "int", "float", "bool" or "string"
+    void add(const String& name, const String& type, const String& value) {
+        vars.push_back({name, type, value, ++revision});
+        listValid = false;
+    }
+
+    // server-side change, seen by the next sync
+    void set(size_t index, const String& value) {
+        Var& v = vars.at(index);
+        v.value = value;
+        v.changedAt = ++revision;
+        listValid = false;
+    }
+
+    size_t size() const { return vars.size(); }
+    const Counters& counters() const { return count; }
+    void resetCounters() { count = Counters(); }
+
+    // size in bytes of the full variable list response
+    size_t listSize() {
+        refreshList();
+        return list.length();
+    }
+
+    String get(const String& endpoint, const String& headers = "") override {
+        Response r;
+        request("GET", endpoint, "", headers, r);
+        return r.body;
+    }
+
+    String post(const String& endpoint, const String& body, const String& headers = "") override {
+        Response r;
+        request("POST", endpoint, body, headers, r);
+        return r.body;
+    }
+
+    bool request(const String& method, const String& endpoint, const String& body,
+                 const String& headers, Response& out) override {
+        count.requests++;
+        count.bytesIn += body.length();
+        if (endpoint == "/api/device/variables" || endpoint == "/api/device/sync") {
+            answerList(headers, out);
+        } else if (endpoint.startsWith("/api/device/")) {
+            out.status = 200;
+            out.body = "{\"success\":true}";
+        } else {
+            out.status = 404;
+        }
+        count.bytesOut += out.body.length();
+        return out.status > 0;
+    }
+
+private:
+    struct Var {
+        String name;
+        String type;
+        String value;
+        unsigned long changedAt;
+    };
+
+    std::vector<Var> vars;
+    unsigned long revision = 0;
+    Counters count;
+
+    String list;            // cached full response
+    bool listValid = false;
+
+    static void appendEntry(String& s, const Var& v) {
+        s += "{\"name\":\"";
+        s += v.name;
+        s += "\",\"type\":\"";
+        s += v.type;
+        s += "\",\"value\":\"";
+        s += v.value;
+        s += "\"}";
+    }
+
+    void appendList(String& s, unsigned long since) {
+        s += "{\"revision\":\"";
+        s += String(revision);
+        s += since ? "\",\"delta\":true,\"variables\":[" : "\",\"variables\":[";
+        bool first = true;
+        for (const Var& v : vars) {
+            if (v.changedAt <= since) continue;
+            if (!first) s += ",";
+            appendEntry(s, v);
+            first = false;
+        }
+        s += "]}";
+    }
+
+    void refreshList() {
+        if (listValid) return;
+        list = "";
+        appendList(list, 0);
+        listValid = true;
+    }
+
+    void answerList(const String& headers, Response& out) {
+        unsigned long since = 0;
+        int p = headers.indexOf("If-None-Match: ");
+        if (p >= 0) since = headers.substring(p + 15).toInt();
+        out.etag = String(revision);
+        if (since == revision) {
+            out.status = 304;
+            return;
+        }
+        out.status = 200;
+        if (since > 0 && since < revision) {
+            appendList(out.body, since);
+        } else {
+            refreshList();
+            out.body = list;
+        }
+    }
+};
+
+#endif
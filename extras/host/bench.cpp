@@ -0,0 +1,134 @@
+// Host benchmark for the client core: cache lookups, sync parsing, delta
+// sync and write encoding against an in-process MockServer, for 10 to 1000
+// variables and different value sizes. Prints ops/s plus heap allocations
+// and bytes allocated per operation (counted by the shim's operator new).
+//
+//   make bench && ./bench            (see Makefile for the ArduinoJson path)
+//   ./bench 2000                     (minimum run time per case in ms)
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <functional>
+#include "../../src/IOTServerClient.h"
+#include "MockServer.h"
+
+namespace {
+
+unsigned long minRunMs = 500;
+
+struct Result {
+    unsigned long ops;
+    double seconds;
+    double allocs;
+    double bytes;
+};
+
+// runs op in rounds until minRunMs has passed; setup/teardown of the round
+// loop is not part of the counts
+Result measure(const std::function<void(unsigned long i)>& op) {
+    for (unsigned long i = 0; i < 16; i++) op(i); // warm up
+
+    unsigned long ops = 0;
+    size_t allocs = host::allocCount();
+    size_t bytes = host::allocBytes();
+    unsigned long start = micros();
+    unsigned long round = 16;
+    while (micros() - start < minRunMs * 1000UL) {
+        for (unsigned long i = 0; i < round; i++) op(ops + i);
+        ops += round;
+        if (round < 65536) round *= 2;
+    }
+    Result r;
+    r.ops = ops;
+    r.seconds = (micros() - start) / 1e6;
+    r.allocs = double(host::allocCount() - allocs) / ops;
+    r.bytes = double(host::allocBytes() - bytes) / ops;
+    return r;
+}
+
+void report(const char* name, size_t vars, size_t valueLen, size_t respBytes, const Result& r) {
+    printf("%-22s %6u %6u %8u %12.0f %9.1f %10.0f\n", name, (unsigned)vars, (unsigned)valueLen,
+           (unsigned)respBytes, r.ops / r.seconds, r.allocs, r.bytes);
+}
+
+String varName(size_t i) {
+    return "v" + String((unsigned long)i);
+}
+
+String stringValue(size_t len, unsigned long seed) {
+    String s;
+    s.reserve(len);
+    for (size_t i = 0; i < len; i++) s += (char)('a' + (seed + i) % 26);
+    return s;
+}
+
+void numericCases(size_t n) {
+    MockServer server;
+    for (size_t i = 0; i < n; i++) server.add(varName(i), "float", "1.5");
+
+    IOTServerClient iot("dvc_bench", "http://mock");
+    iot.setTransport(&server);
+    iot.begin();
+    iot.syncNow(); // fills the cache
+
+    std::vector<String> names;
+    std::vector<FloatHandle> handles;
+    for (size_t i = 0; i < n; i++) {
+        names.push_back(varName(i));
+        handles.push_back(iot.declareFloat(names.back()));
+    }
+    unsigned long fired = 0;
+    for (size_t i = 0; i < n; i++) iot.onWriteFloat(names[i], [&fired](float) { fired++; });
+
+    volatile float sink = 0;
+    report("read by name", n, 3, 0, measure([&](unsigned long i) { sink = sink + iot.virtualReadFloat(names[i % n]); }));
+    report("read by handle", n, 3, 0, measure([&](unsigned long i) { sink = sink + handles[i % n].read(); }));
+
+    iot.setDeltaSync(false);
+    report("sync full (no change)", n, 3, server.listSize(), measure([&](unsigned long) { iot.syncNow(); }));
+
+    iot.setDeltaSync(true);
+    iot.syncNow();
+    report("sync delta 304", n, 3, 0, measure([&](unsigned long) { iot.syncNow(); }));
+
+    report("sync delta 1 change", n, 3, 0, measure([&](unsigned long i) {
+        server.set(i % n, String(float(i % 1000) / 10, 1));
+        iot.syncNow();
+    }));
+
+    report("write by name", n, 3, 0, measure([&](unsigned long i) { iot.virtualWrite(names[i % n], float(i % 1000)); }));
+    report("write by handle", n, 3, 0, measure([&](unsigned long i) { handles[i % n].write(float(i % 1000)); }));
+
+    if (fired == 0) printf("  (no callbacks fired)\n");
+}
+
+void stringCases(size_t n, size_t len) {
+    MockServer server;
+    for (size_t i = 0; i < n; i++) server.add(varName(i), "string", stringValue(len, i));
+
+    IOTServerClient iot("dvc_bench", "http://mock");
+    iot.setTransport(&server);
+    iot.begin();
+    iot.syncNow();
+
+    std::vector<StringHandle> handles;
+    for (size_t i = 0; i < n; i++) handles.push_back(iot.declareString(varName(i)));
+    String value = stringValue(len, 7);
+
+    report("string sync full", n, len, server.listSize(), measure([&](unsigned long) { iot.syncNow(); }));
+    report("string read", n, len, 0, measure([&](unsigned long i) { handles[i % n].read(); }));
+    report("string write", n, len, 0, measure([&](unsigned long i) { handles[i % n].write(value); }));
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) minRunMs = strtoul(argv[1], nullptr, 10);
+
+    printf("%-22s %6s %6s %8s %12s %9s %10s\n", "case", "vars", "vlen", "resp", "ops/s", "allocs/op", "bytes/op");
+    const size_t counts[] = {10, 100, 1000};
+    for (size_t n : counts) numericCases(n);
+    const size_t lengths[] = {8, 64, 256};
+    for (size_t len : lengths) stringCases(100, len);
+    return 0;
+}
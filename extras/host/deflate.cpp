@@ -0,0 +1,216 @@
+// Round-trip check of the deflate codec (src/Deflate.cpp), no device or
+// server needed. zlib output with stored, fixed, dynamic, RLE and Huffman-only
+// blocks and with a 512-byte window has to inflate back to its input, so does
+// deflateZlib() output, and damaged or oversized streams have to be refused.
+//
+//   ./deflate-check        prints the failed cases, exits 1 if there are any
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "../../src/Deflate.h"
+#include "../../src/MemStream.h"
+
+namespace {
+
+// a variable list as the server sends it, n entries
+std::string text(unsigned n) {
+    static const char* types[] = { "int", "float", "bool", "string" };
+    std::string s = "{\"variables\":[";
+    char entry[96];
+    for (unsigned i = 0; i < n; i++) {
+        snprintf(entry, sizeof(entry), "%s{\"name\":\"sensor%u\",\"type\":\"%s\",\"value\":\"%u\"}",
+                 i ? "," : "", i % 37, types[i % 4], (i * 7919) % 10007);
+        s += entry;
+    }
+    return s + "]}";
+}
+
+// Python's zlib.compressobj(level, DEFLATED, wbits, 9, strategy) over text():
+//   storedZ     text(2),  level 0, wbits 15
+//   fixedZ      text(8),  level 6, wbits 15, Z_FIXED
+//   dynamicZ    text(8),  level 9, wbits 15
+//   rleZ        text(8),  level 6, wbits 15, Z_RLE
+//   huffmanZ    text(8),  level 6, wbits 15, Z_HUFFMAN_ONLY
+//   window512Z  text(24), level 6, wbits 9
+const uint8_t storedZ[] = {
+    0x78, 0x01, 0x01, 0x6c, 0x00, 0x93, 0xff, 0x7b, 0x22, 0x76, 0x61, 0x72, 0x69, 0x61, 0x62, 0x6c,
+    0x65, 0x73, 0x22, 0x3a, 0x5b, 0x7b, 0x22, 0x6e, 0x61, 0x6d, 0x65, 0x22, 0x3a, 0x22, 0x73, 0x65,
+    0x6e, 0x73, 0x6f, 0x72, 0x30, 0x22, 0x2c, 0x22, 0x74, 0x79, 0x70, 0x65, 0x22, 0x3a, 0x22, 0x69,
+    0x6e, 0x74, 0x22, 0x2c, 0x22, 0x76, 0x61, 0x6c, 0x75, 0x65, 0x22, 0x3a, 0x22, 0x30, 0x22, 0x7d,
+    0x2c, 0x7b, 0x22, 0x6e, 0x61, 0x6d, 0x65, 0x22, 0x3a, 0x22, 0x73, 0x65, 0x6e, 0x73, 0x6f, 0x72,
+    0x31, 0x22, 0x2c, 0x22, 0x74, 0x79, 0x70, 0x65, 0x22, 0x3a, 0x22, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+    0x22, 0x2c, 0x22, 0x76, 0x61, 0x6c, 0x75, 0x65, 0x22, 0x3a, 0x22, 0x37, 0x39, 0x31, 0x39, 0x22,
+    0x7d, 0x5d, 0x7d, 0x80, 0x87, 0x22, 0x40,
+};
+const uint8_t fixedZ[] = {
+    0x78, 0x01, 0xab, 0x56, 0x2a, 0x4b, 0x2c, 0xca, 0x4c, 0x4c, 0xca, 0x49, 0x2d, 0x56, 0xb2, 0x8a,
+    0xae, 0x56, 0xca, 0x4b, 0xcc, 0x4d, 0x55, 0xb2, 0x52, 0x2a, 0x4e, 0xcd, 0x2b, 0xce, 0x2f, 0x32,
+    0x50, 0xd2, 0x51, 0x2a, 0xa9, 0x2c, 0x00, 0x09, 0x64, 0xe6, 0x95, 0x00, 0x39, 0x65, 0x89, 0x39,
+    0xa5, 0x20, 0x9e, 0x81, 0x52, 0xad, 0x0e, 0x9a, 0x5a, 0x43, 0x84, 0xda, 0xb4, 0x9c, 0xfc, 0x44,
+    0x64, 0xd5, 0xe6, 0x96, 0x86, 0x96, 0x98, 0x1a, 0x8c, 0x10, 0x1a, 0x92, 0xf2, 0xf3, 0x73, 0x90,
+    0xd4, 0x9b, 0x5a, 0x18, 0x1b, 0x62, 0xaa, 0x37, 0x46, 0xa8, 0x2f, 0x2e, 0x29, 0xca, 0xcc, 0x4b,
+    0x47, 0xd2, 0x61, 0x6c, 0x6e, 0x62, 0x8c, 0xa9, 0xc3, 0x04, 0x97, 0xf3, 0x0d, 0xcd, 0x4c, 0x4d,
+    0x31, 0x95, 0x9b, 0xe2, 0xf6, 0x81, 0xa5, 0xa9, 0xb9, 0x09, 0xa6, 0x06, 0x33, 0x9c, 0x3e, 0x30,
+    0x37, 0xb1, 0x30, 0xc3, 0x54, 0x6f, 0x8e, 0xc7, 0x07, 0xa6, 0xc6, 0x96, 0x16, 0x4a, 0xb5, 0xb1,
+    0xb5, 0x00, 0x9d, 0xaf, 0x7b, 0x88,
+};
+const uint8_t dynamicZ[] = {
+    0x78, 0xda, 0x7d, 0xcf, 0x4d, 0x0a, 0xc3, 0x20, 0x10, 0x86, 0xe1, 0xbb, 0xcc, 0x3a, 0x8b, 0x58,
+    0x1d, 0x7f, 0x72, 0x95, 0xd2, 0x85, 0x01, 0x5b, 0x04, 0xab, 0x45, 0x6d, 0x20, 0x04, 0xef, 0xde,
+    0x66, 0xa5, 0x54, 0xec, 0x72, 0xe4, 0x79, 0xc1, 0xef, 0x80, 0x4d, 0x47, 0xab, 0x57, 0x67, 0x12,
+    0x2c, 0xd7, 0x03, 0xbc, 0x7e, 0x1a, 0x58, 0x20, 0x19, 0x9f, 0x42, 0x9c, 0x61, 0x82, 0xbc, 0xbf,
+    0xce, 0x07, 0xeb, 0xf3, 0xf7, 0xd8, 0xb4, 0x7b, 0x9f, 0xd7, 0x0c, 0x65, 0xfa, 0xb1, 0xa4, 0xda,
+    0xbb, 0x0b, 0xba, 0xd5, 0x42, 0x11, 0xd5, 0x07, 0x97, 0x1a, 0xac, 0x21, 0xb8, 0xc6, 0xa3, 0xa4,
+    0xa4, 0xf7, 0xb4, 0xfa, 0x94, 0xa3, 0xf5, 0x8f, 0xa6, 0xa0, 0x82, 0xd1, 0xbe, 0x60, 0xa3, 0xef,
+    0x13, 0x8e, 0xd8, 0x73, 0x1c, 0x2f, 0x50, 0x28, 0x58, 0x1f, 0xf0, 0xe1, 0x02, 0xc1, 0x24, 0xef,
+    0xbd, 0xf8, 0xb3, 0x00, 0xa9, 0x92, 0x50, 0x6e, 0xe5, 0x03, 0x9d, 0xaf, 0x7b, 0x88,
+};
+const uint8_t rleZ[] = {
+    0x78, 0x01, 0x05, 0xc1, 0x41, 0x6a, 0xc3, 0x40, 0x0c, 0x40, 0xd1, 0xbb, 0xfc, 0xb5, 0x16, 0x4d,
+    0x1d, 0xc7, 0x89, 0xae, 0x52, 0xba, 0x50, 0x40, 0x29, 0x86, 0xb1, 0xc6, 0x8c, 0xc6, 0x06, 0x63,
+    0x7c, 0xf7, 0xbe, 0x77, 0xb2, 0x5b, 0x9b, 0xed, 0x5d, 0x3c, 0xd1, 0x9f, 0x93, 0xb0, 0xc5, 0x51,
+    0xd2, 0x23, 0x6b, 0xfb, 0x42, 0xe8, 0xc7, 0xea, 0x28, 0x73, 0x74, 0x84, 0xdd, 0xca, 0xe6, 0x28,
+    0x5f, 0x5c, 0x72, 0x12, 0xb6, 0x38, 0x4a, 0x7a, 0x64, 0x6d, 0x37, 0x84, 0x7e, 0xac, 0x8e, 0xf2,
+    0x29, 0xd5, 0x3a, 0xc2, 0x6e, 0x65, 0x73, 0x94, 0xe9, 0x75, 0x7b, 0x71, 0xc9, 0x49, 0xd8, 0xe2,
+    0x28, 0xe9, 0x91, 0xb5, 0x7d, 0x23, 0xf4, 0x63, 0x75, 0x94, 0x77, 0xad, 0x05, 0x61, 0xb7, 0xb2,
+    0x39, 0xca, 0xf8, 0x1c, 0x6e, 0x5c, 0x72, 0x12, 0xb6, 0x38, 0x4a, 0x7a, 0x64, 0x6d, 0x03, 0x42,
+    0x3f, 0x56, 0x47, 0xc9, 0xde, 0xe6, 0xf8, 0x43, 0xd8, 0xad, 0x6c, 0x8e, 0x32, 0x4c, 0xf7, 0x81,
+    0x4b, 0x4e, 0xc2, 0x16, 0x47, 0x49, 0x8f, 0xac, 0xed, 0x8e, 0xd0, 0x8f, 0xd5, 0x51, 0xe6, 0xe8,
+    0x08, 0xbb, 0x95, 0xcd, 0x51, 0x6e, 0x8f, 0x71, 0xe4, 0x92, 0x93, 0xb0, 0xc5, 0x51, 0xd2, 0x23,
+    0x6b, 0x1b, 0x11, 0xfa, 0xb1, 0x3a, 0xca, 0xa7, 0x54, 0xeb, 0x08, 0xbb, 0x95, 0xcd, 0x51, 0x5e,
+    0xe3, 0x74, 0xe7, 0x92, 0x93, 0xb0, 0xc5, 0x51, 0xd2, 0x23, 0x6b, 0x7b, 0x20, 0xf4, 0x63, 0x75,
+    0x94, 0x77, 0xad, 0x05, 0x61, 0xb7, 0xb2, 0x39, 0xca, 0x74, 0x7f, 0x3e, 0xb8, 0xe4, 0x24, 0x6c,
+    0x71, 0x94, 0xf4, 0xc8, 0xda, 0x26, 0x84, 0x7e, 0xac, 0x8e, 0x92, 0xbd, 0xcd, 0xf1, 0x87, 0xb0,
+    0x5b, 0xd9, 0x1c, 0x65, 0x1c, 0x5e, 0x4f, 0xae, 0xdf, 0xeb, 0x1f, 0x9d, 0xaf, 0x7b, 0x88,
+};
+const uint8_t huffmanZ[] = {
+    0x78, 0x01, 0x05, 0xc1, 0x41, 0x6a, 0xc3, 0x40, 0x0c, 0x40, 0xd1, 0xbb, 0xfc, 0xb5, 0x16, 0x4d,
+    0x1d, 0xc7, 0x89, 0xae, 0x52, 0xba, 0x50, 0x40, 0x29, 0x86, 0xb1, 0xc6, 0x8c, 0xc6, 0x06, 0x63,
+    0x7c, 0xf7, 0xbe, 0x77, 0xb2, 0x5b, 0x9b, 0xed, 0x5d, 0x3c, 0xd1, 0x9f, 0x93, 0xb0, 0xc5, 0x51,
+    0xd2, 0x23, 0x6b, 0xfb, 0x42, 0xe8, 0xc7, 0xea, 0x28, 0x73, 0x74, 0x84, 0xdd, 0xca, 0xe6, 0x28,
+    0x5f, 0x5c, 0x72, 0x12, 0xb6, 0x38, 0x4a, 0x7a, 0x64, 0x6d, 0x37, 0x84, 0x7e, 0xac, 0x8e, 0xf2,
+    0x29, 0xd5, 0x3a, 0xc2, 0x6e, 0x65, 0x73, 0x94, 0xe9, 0x75, 0x7b, 0x71, 0xc9, 0x49, 0xd8, 0xe2,
+    0x28, 0xe9, 0x91, 0xb5, 0x7d, 0x23, 0xf4, 0x63, 0x75, 0x94, 0x77, 0xad, 0x05, 0x61, 0xb7, 0xb2,
+    0x39, 0xca, 0xf8, 0x1c, 0x6e, 0x5c, 0x72, 0x12, 0xb6, 0x38, 0x4a, 0x7a, 0x64, 0x6d, 0x03, 0x42,
+    0x3f, 0x56, 0x47, 0xc9, 0xde, 0xe6, 0xf8, 0x43, 0xd8, 0xad, 0x6c, 0x8e, 0x32, 0x4c, 0xf7, 0x81,
+    0x4b, 0x4e, 0xc2, 0x16, 0x47, 0x49, 0x8f, 0xac, 0xed, 0x8e, 0xd0, 0x8f, 0xd5, 0x51, 0xe6, 0xe8,
+    0x08, 0xbb, 0x95, 0xcd, 0x51, 0x6e, 0x8f, 0x71, 0xe4, 0x92, 0x93, 0xb0, 0xc5, 0x51, 0xd2, 0x23,
+    0x6b, 0x1b, 0x11, 0xfa, 0xb1, 0x3a, 0xca, 0xa7, 0x54, 0xeb, 0x08, 0xbb, 0x95, 0xcd, 0x51, 0x5e,
+    0xe3, 0x74, 0xe7, 0x92, 0x93, 0xb0, 0xc5, 0x51, 0xd2, 0x23, 0x6b, 0x7b, 0x20, 0xf4, 0x63, 0x75,
+    0x94, 0x77, 0xad, 0x05, 0x61, 0xb7, 0xb2, 0x39, 0xca, 0x74, 0x7f, 0x3e, 0xb8, 0xe4, 0x24, 0x6c,
+    0x71, 0x94, 0xf4, 0xc8, 0xda, 0x26, 0x84, 0x7e, 0xac, 0x8e, 0x92, 0xbd, 0xcd, 0xf1, 0x87, 0xb0,
+    0x5b, 0xd9, 0x1c, 0x65, 0x1c, 0x5e, 0x4f, 0xae, 0xdf, 0xeb, 0x1f, 0x9d, 0xaf, 0x7b, 0x88,
+};
+const uint8_t window512Z[] = {
+    0x18, 0x95, 0x7d, 0x8f, 0xcb, 0x6e, 0x83, 0x40, 0x0c, 0x00, 0xff, 0x65, 0xcf, 0x39, 0xac, 0x5f,
+    0xeb, 0xdd, 0xfc, 0x4a, 0xd5, 0x03, 0x91, 0x68, 0x84, 0x44, 0xa0, 0x02, 0x1a, 0xa9, 0x8a, 0xf8,
+    0xf7, 0x92, 0x13, 0xa8, 0x6b, 0x73, 0xb4, 0x35, 0x63, 0x79, 0x5e, 0xe1, 0xd9, 0x4c, 0x5d, 0x73,
+    0xeb, 0xdb, 0x39, 0x5c, 0x3f, 0x5e, 0x61, 0x68, 0x1e, 0x6d, 0xb8, 0x86, 0xb9, 0x1d, 0xe6, 0x71,
+    0x8a, 0xe1, 0x12, 0x96, 0xdf, 0xef, 0xf7, 0xa2, 0x1b, 0x96, 0x6d, 0x78, 0x36, 0xfd, 0xcf, 0x7b,
+    0x8a, 0x61, 0xbd, 0xfc, 0x63, 0x61, 0x67, 0xbf, 0xfa, 0xb1, 0x39, 0xd2, 0x5a, 0xa0, 0xd4, 0x02,
+    0xee, 0xc2, 0x6d, 0x1c, 0xfb, 0x03, 0x2f, 0x99, 0xa0, 0xe6, 0x69, 0xe7, 0xe7, 0x65, 0xea, 0x86,
+    0xfb, 0xc1, 0x20, 0x65, 0xaa, 0x0d, 0xf6, 0xde, 0x87, 0x24, 0x52, 0xe3, 0xe2, 0x17, 0x14, 0x51,
+    0xae, 0x85, 0xe4, 0x16, 0x28, 0xe7, 0x54, 0xf3, 0x7a, 0x52, 0x20, 0x54, 0x72, 0x6d, 0x64, 0xaf,
+    0x80, 0x08, 0x62, 0x8d, 0x17, 0xbf, 0x00, 0x10, 0xb1, 0x16, 0xb6, 0x23, 0x5e, 0x42, 0x01, 0x06,
+    0x43, 0x80, 0x93, 0x06, 0x8d, 0x42, 0x86, 0x82, 0x5e, 0x04, 0x97, 0x24, 0x06, 0x4f, 0x7e, 0x05,
+    0x66, 0x55, 0xc3, 0x60, 0xb7, 0x42, 0x73, 0x31, 0x78, 0x39, 0x89, 0xc8, 0x1a, 0xb3, 0xa1, 0x24,
+    0x2f, 0x22, 0x25, 0x8c, 0x06, 0xaf, 0x7e, 0x04, 0x0b, 0xa1, 0x61, 0x64, 0x37, 0x02, 0x99, 0xd9,
+    0x10, 0xca, 0x49, 0x05, 0x49, 0xaa, 0x8d, 0xed, 0x51, 0x27, 0x22, 0xa3, 0x8a, 0xc1, 0x83, 0x1f,
+    0x91, 0x20, 0xab, 0x61, 0xa0, 0x1b, 0xc1, 0xb1, 0x14, 0x43, 0xa0, 0x93, 0x08, 0x8c, 0x00, 0x61,
+    0xfd, 0x5c, 0xff, 0x00, 0x23, 0xff, 0x6a, 0x86,
+};
+
+struct Result {
+    std::string out;
+    bool finished;
+    bool tooLarge;
+};
+
+Result inflate(const uint8_t* z, size_t n, uint8_t bits) {
+    static uint8_t window[1 << 15];
+    MemStream ms((const char*)z, n);
+    ms.setTimeout(0);
+    InflateStream in(ms, window, bits);
+    Result r;
+    int c;
+    while ((c = in.read()) >= 0) r.out += (char)c;
+    r.finished = in.finished();
+    r.tooLarge = in.tooLarge();
+    return r;
+}
+
+int failures = 0;
+
+void expect(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    failures++;
+}
+
+void checkZlib(const char* name, const uint8_t* z, size_t n, unsigned entries, uint8_t bits) {
+    Result r = inflate(z, n, bits);
+    expect(r.finished && r.out == text(entries), name);
+}
+
+// deflateZlib() then inflate with the window it declares (1 KB)
+void checkRoundTrip(const char* name, const std::string& data) {
+    std::vector<uint8_t> z;
+    if (!deflateZlib((const uint8_t*)data.data(), data.size(), z)) {
+        expect(false, name);
+        return;
+    }
+    expect(z.size() < data.size(), name);
+    Result r = inflate(z.data(), z.size(), 10);
+    expect(r.finished && r.out == data, name);
+}
+
+}
+
+int main() {
+    checkZlib("stored", storedZ, sizeof(storedZ), 2, 15);
+    checkZlib("fixed", fixedZ, sizeof(fixedZ), 8, 15);
+    checkZlib("dynamic", dynamicZ, sizeof(dynamicZ), 8, 15);
+    checkZlib("rle", rleZ, sizeof(rleZ), 8, 15);
+    checkZlib("huffman-only", huffmanZ, sizeof(huffmanZ), 8, 15);
+    checkZlib("512-byte window", window512Z, sizeof(window512Z), 24, 9);
+    checkZlib("512-byte window, larger buffer", window512Z, sizeof(window512Z), 24, 12);
+
+    // a stream asking for more window than given
+    Result big = inflate(dynamicZ, sizeof(dynamicZ), 12);
+    expect(big.tooLarge && !big.finished, "window too large");
+
+    // damage: checksum, data, truncation
+    std::vector<uint8_t> bad(dynamicZ, dynamicZ + sizeof(dynamicZ));
+    bad.back() ^= 1;
+    expect(!inflate(bad.data(), bad.size(), 15).finished, "corrupt checksum");
+    bad.assign(dynamicZ, dynamicZ + sizeof(dynamicZ));
+    bad[bad.size() / 2] ^= 0x10;
+    expect(!inflate(bad.data(), bad.size(), 15).finished, "corrupt data");
+    expect(!inflate(dynamicZ, sizeof(dynamicZ) - 3, 15).finished, "truncated");
+
+    checkRoundTrip("round trip, 8 entries", text(8));
+    checkRoundTrip("round trip, 200 entries", text(200));
+    checkRoundTrip("round trip, long runs", std::string(5000, 'a') + std::string(3000, 'b'));
+
+    // deflateZlib() declares a 1 KB window
+    std::vector<uint8_t> z;
+    std::string list = text(200);
+    deflateZlib((const uint8_t*)list.data(), list.size(), z);
+    expect(inflate(z.data(), z.size(), 9).tooLarge, "round trip, declared window");
+
+    // refused: incompressible, too long
+    std::string noise;
+    uint32_t x = 1;
+    for (int i = 0; i < 2000; i++) {
+        x = x * 1103515245u + 12345u;
+        noise += (char)(x >> 24);
+    }
+    expect(!deflateZlib((const uint8_t*)noise.data(), noise.size(), z), "incompressible input refused");
+    std::string huge(0x10000, 'x');
+    expect(!deflateZlib((const uint8_t*)huge.data(), huge.size(), z), "input over 64 KB refused");
+
+    if (failures == 0) printf("deflate: all cases passed\n");
+    return failures ? 1 : 0;
+}
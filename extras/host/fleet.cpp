@@ -0,0 +1,281 @@
+// Load generator: runs many IOTServerClient instances against a real server,
+// each with its own device key, in async mode so one thread can drive
+// hundreds of them from a plain event loop. The traffic is the library's own:
+// heartbeat + sync every interval from loop(), plus virtualWrite() bursts.
+// Latency comes from the clients' request statistics (IOT_ENABLE_METRICS),
+// merged over the fleet and reported per endpoint, twice: as the client saw
+// it (queueing, connect and event-loop delay included) and as send -> first
+// response byte, which is what the server is responsible for. Connects and
+// sends never block, and no thread runs more than --per-thread devices, so
+// one slow socket or a long pass doesn't hold up the rest; the mean and worst
+// pass time are printed so the polling delay is visible too.
+//
+//   ./fleet --url http://127.0.0.1:8080 --devices 2000 --threads 4 --duration 120
+//
+// Options (defaults in brackets):
+//   --url URL          server base URL [http://127.0.0.1:8080]
+//   --devices N        virtual devices [100]
+//   --threads N        event-loop threads [CPU count]
+//   --per-thread N     most devices one thread drives, adds threads if needed [250]
+//   --duration S       run time in seconds [60]
+//   --interval MS      heartbeat/sync interval [10000]
+//   --write-rate R     writes per second per device (0 = none) [0.1]
+//   --burst N          writes per burst [1]
+//   --vars N           distinct variables written per device [4]
+//   --jitter F         +/- fraction applied to burst spacing and start offsets [0.2]
+//   --timeout MS       request timeout [5000]
+//   --delta            enable delta sync
+//   --keys FILE        device keys, one per line (default: <prefix><index>)
+//   --key-prefix P     prefix for generated keys [dvc_load_]
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../../src/IOTServerClient.h"
+
+#if !IOT_ENABLE_METRICS
+#error "fleet needs -DIOT_ENABLE_METRICS=1 (see Makefile)"
+#endif
+
+namespace {
+
+struct Options {
+    String url = "http://127.0.0.1:8080";
+    unsigned devices = 100;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned perThread = 250;
+    unsigned long durationMs = 60000;
+    unsigned long intervalMs = 10000;
+    float writeRate = 0.1f;
+    unsigned burst = 1;
+    unsigned vars = 4;
+    float jitter = 0.2f;
+    unsigned long timeoutMs = 5000;
+    bool delta = false;
+    String keysFile;
+    String keyPrefix = "dvc_load_";
+};
+
+struct Device {
+    std::unique_ptr<IOTServerClient> iot;
+    unsigned long startAt = 0;   // ms after the run starts
+    unsigned long nextWrite = 0;
+    bool started = false;
+    unsigned long writesDropped = 0; // async queue full
+};
+
+// one event-loop thread's pass times
+struct LoopStats {
+    unsigned long passes = 0;
+    unsigned long totalMs = 0;
+    unsigned long maxMs = 0;
+};
+
+Options opt;
+
+// d +/- jitter, at least 1
+unsigned long jittered(unsigned long d) {
+    long span = (long)(d * opt.jitter);
+    long v = (long)d + (span > 0 ? random(-span, span + 1) : 0);
+    return v > 0 ? v : 1;
+}
+
+void writeBurst(Device& d, unsigned long seq) {
+    for (unsigned i = 0; i < opt.burst; i++) {
+        String name = "load" + String((unsigned long)((seq + i) % opt.vars));
+        if (!d.iot->virtualWrite(name, float(random(0, 10000)) / 100)) d.writesDropped++;
+    }
+}
+
+void runSlice(std::vector<Device>* all, size_t from, size_t to, unsigned long t0, unsigned seed, LoopStats* ls) {
+    randomSeed(seed);
+    unsigned long burstGap = opt.writeRate > 0 ? (unsigned long)(1000.0f * opt.burst / opt.writeRate) : 0;
+    unsigned long seq = 0;
+
+    for (size_t i = from; i < to; i++) {
+        Device& d = (*all)[i];
+        // spread the fleet over one interval so heartbeats don't line up
+        d.startAt = (unsigned long)random(0, opt.intervalMs);
+        if (burstGap) d.nextWrite = d.startAt + jittered(burstGap);
+    }
+
+    unsigned long end = t0 + opt.durationMs;
+    unsigned long drainUntil = end + opt.timeoutMs * 2;
+    while (true) {
+        unsigned long now = millis();
+        bool stopping = now >= end;
+        bool busy = false;
+        for (size_t i = from; i < to; i++) {
+            Device& d = (*all)[i];
+            if (!d.started) {
+                if (stopping || now - t0 < d.startAt) continue;
+                d.iot->begin();
+                d.iot->syncNow();
+                d.started = true;
+            }
+            if (stopping) {
+                // let queued requests finish, start nothing new
+                if (d.iot->isBusy()) {
+                    d.iot->loop();
+                    busy = true;
+                }
+                continue;
+            }
+            if (burstGap && now - t0 >= d.nextWrite) {
+                writeBurst(d, seq++);
+                d.nextWrite += jittered(burstGap);
+            }
+            d.iot->loop();
+            busy = busy || d.iot->isBusy();
+        }
+        unsigned long pass = millis() - now;
+        ls->passes++;
+        ls->totalMs += pass;
+        if (pass > ls->maxMs) ls->maxMs = pass;
+        if (stopping && (!busy || now >= drainUntil)) break;
+        if (!busy) delay(1);
+    }
+}
+
+void addTo(EndpointStats& into, const EndpointStats& e) {
+    into.requests += e.requests;
+    into.failures += e.failures;
+    into.retries += e.retries;
+    into.bytesSent += e.bytesSent;
+    into.bytesReceived += e.bytesReceived;
+    into.latency.merge(e.latency);
+    into.server.merge(e.server);
+}
+
+void printRow(const char* name, const EndpointStats& e, double seconds) {
+    printf("%-10s %9lu %8lu %8lu %9.1f %7lu %7lu %7lu %7lu %7lu %7lu %10lu %10lu\n", name,
+           (unsigned long)e.requests, (unsigned long)e.failures, (unsigned long)e.retries, e.requests / seconds,
+           e.latency.percentile(50), e.latency.percentile(90), e.latency.percentile(99), e.server.percentile(50),
+           e.server.percentile(90), e.server.percentile(99), (unsigned long)e.bytesSent,
+           (unsigned long)e.bytesReceived);
+}
+
+bool parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        String a = argv[i];
+        if (a == "--delta") { opt.delta = true; continue; }
+        if (i + 1 >= argc) return false;
+        const char* v = argv[++i];
+        if (a == "--url") opt.url = v;
+        else if (a == "--devices") opt.devices = strtoul(v, nullptr, 10);
+        else if (a == "--threads") opt.threads = strtoul(v, nullptr, 10);
+        else if (a == "--per-thread") opt.perThread = strtoul(v, nullptr, 10);
+        else if (a == "--duration") opt.durationMs = strtoul(v, nullptr, 10) * 1000UL;
+        else if (a == "--interval") opt.intervalMs = strtoul(v, nullptr, 10);
+        else if (a == "--write-rate") opt.writeRate = atof(v);
+        else if (a == "--burst") opt.burst = strtoul(v, nullptr, 10);
+        else if (a == "--vars") opt.vars = strtoul(v, nullptr, 10);
+        else if (a == "--jitter") opt.jitter = atof(v);
+        else if (a == "--timeout") opt.timeoutMs = strtoul(v, nullptr, 10);
+        else if (a == "--keys") opt.keysFile = v;
+        else if (a == "--key-prefix") opt.keyPrefix = v;
+        else return false;
+    }
+    if (opt.threads == 0) opt.threads = 1;
+    if (opt.perThread > 0 && opt.threads < (opt.devices + opt.perThread - 1) / opt.perThread) {
+        opt.threads = (opt.devices + opt.perThread - 1) / opt.perThread;
+    }
+    if (opt.threads > opt.devices) opt.threads = opt.devices ? opt.devices : 1;
+    if (opt.vars == 0) opt.vars = 1;
+    if (opt.burst == 0) opt.burst = 1;
+    return opt.intervalMs > 0;
+}
+
+std::vector<String> deviceKeys() {
+    std::vector<String> keys;
+    if (opt.keysFile.length() > 0) {
+        FILE* f = fopen(opt.keysFile.c_str(), "r");
+        char line[256];
+        while (f && keys.size() < opt.devices && fgets(line, sizeof(line), f)) {
+            String k = line;
+            k.trim();
+            if (k.length() > 0) keys.push_back(k);
+        }
+        if (f) fclose(f);
+        if (keys.size() < opt.devices) {
+            fprintf(stderr, "%s: %u keys for %u devices\n", opt.keysFile.c_str(), (unsigned)keys.size(), opt.devices);
+            opt.devices = keys.size();
+        }
+        return keys;
+    }
+    for (unsigned i = 0; i < opt.devices; i++) keys.push_back(opt.keyPrefix + String(i));
+    return keys;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv)) {
+        fprintf(stderr, "usage: fleet [--url URL] [--devices N] [--threads N] [--per-thread N] [--duration S]\n"
+                        "             [--interval MS] [--write-rate R] [--burst N] [--vars N] [--jitter F] [--timeout MS]\n"
+                        "             [--delta] [--keys FILE | --key-prefix P]\n");
+        return 2;
+    }
+
+    std::vector<String> keys = deviceKeys();
+    std::vector<Device> devices(opt.devices);
+    for (unsigned i = 0; i < opt.devices; i++) {
+        IOTServerClient* iot = new IOTServerClient(keys[i], opt.url);
+        iot->setAsync(true);
+        iot->setHeartbeatInterval(opt.intervalMs);
+        iot->setRequestTimeout(opt.timeoutMs);
+        iot->setDeltaSync(opt.delta);
+        devices[i].iot.reset(iot);
+    }
+
+    printf("%u devices on %u threads, %lu s against %s\n", opt.devices, opt.threads, opt.durationMs / 1000,
+           opt.url.c_str());
+    unsigned long t0 = millis();
+    std::vector<std::thread> workers;
+    std::vector<LoopStats> loops(opt.threads);
+    size_t per = (opt.devices + opt.threads - 1) / opt.threads;
+    for (unsigned t = 0; t < opt.threads; t++) {
+        size_t from = t * per;
+        size_t to = from + per < opt.devices ? from + per : opt.devices;
+        if (from >= to) break;
+        workers.emplace_back(runSlice, &devices, from, to, t0, 1000 + t, &loops[t]);
+    }
+    for (std::thread& w : workers) w.join();
+    double seconds = (millis() - t0) / 1000.0;
+
+    EndpointStats perEndpoint[STATS_ENDPOINTS];
+    EndpointStats all;
+    unsigned long dropped = 0;
+    for (Device& d : devices) {
+        const ClientStats& st = d.iot->getStats();
+        for (int e = 0; e < STATS_ENDPOINTS; e++) {
+            addTo(perEndpoint[e], st[(StatsEndpoint)e]);
+            addTo(all, st[(StatsEndpoint)e]);
+        }
+        dropped += d.writesDropped;
+    }
+
+    printf("%-10s %9s %8s %8s %9s %-23s %-23s %10s %10s\n", "", "", "", "", "", "client-side latency ms",
+           "server (send->1st byte)", "", "");
+    printf("%-10s %9s %8s %8s %9s %7s %7s %7s %7s %7s %7s %10s %10s\n", "endpoint", "requests", "failed", "retries",
+           "req/s", "p50", "p90", "p99", "p50", "p90", "p99", "tx bytes", "rx bytes");
+    for (int e = 0; e < STATS_ENDPOINTS; e++) {
+        if (perEndpoint[e].requests == 0) continue;
+        printRow(ClientStats::name((StatsEndpoint)e), perEndpoint[e], seconds);
+    }
+    printRow("all", all, seconds);
+    if (dropped) printf("%lu writes not queued (async queue full)\n", dropped);
+    LoopStats loop;
+    for (const LoopStats& l : loops) {
+        loop.passes += l.passes;
+        loop.totalMs += l.totalMs;
+        loop.maxMs = std::max(loop.maxMs, l.maxMs);
+    }
+    printf("event-loop pass: mean %.2f ms, max %lu ms (polling delay in both latency columns)\n",
+           loop.passes ? (double)loop.totalMs / loop.passes : 0.0, loop.maxMs);
+    printf("latency: power-of-two buckets, interpolated\n");
+    return all.failures ? 1 : 0;
+}
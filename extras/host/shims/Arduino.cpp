@@ -0,0 +1,115 @@
+#include "Arduino.h"
+#include <atomic>
+#include <cstddef>
+#include <chrono>
+#include <new>
+#include <random>
+#include <thread>
+
+EspClass ESP;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point started = Clock::now();
+
+// pretend heap so getFreeHeap() has a meaning on the host
+const size_t heapSize = 320 * 1024;
+
+std::atomic<size_t> allocs{0};
+std::atomic<size_t> allocated{0};
+std::atomic<size_t> live{0};
+std::atomic<size_t> peak{0};
+
+// the size is stored in front of each block so delete can account for it
+const size_t header = alignof(std::max_align_t);
+
+void* countedAlloc(size_t n) {
+    void* p = malloc(n + header);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = n;
+    allocs++;
+    allocated += n;
+    size_t now = live += n;
+    size_t top = peak.load();
+    while (now > top && !peak.compare_exchange_weak(top, now)) {}
+    return (char*)p + header;
+}
+
+void countedFree(void* p) {
+    if (!p) return;
+    char* base = (char*)p - header;
+    live -= *(size_t*)base;
+    free(base);
+}
+
+thread_local std::minstd_rand rng{1};
+
+}
+
+void* operator new(size_t n) { return countedAlloc(n); }
+void* operator new[](size_t n) { return countedAlloc(n); }
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+
+namespace host {
+size_t allocCount() { return allocs.load(); }
+size_t allocBytes() { return allocated.load(); }
+size_t liveBytes() { return live.load(); }
+}
+
+uint32_t EspClass::getFreeHeap() {
+    size_t l = live.load();
+    return l < heapSize ? heapSize - l : 0;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    size_t p = peak.load();
+    return p < heapSize ? heapSize - p : 0;
+}
+
+unsigned long millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count();
+}
+
+unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+long random(long max) {
+    return max > 0 ? (long)(rng() % (unsigned long)max) : 0;
+}
+
+long random(long min, long max) {
+    return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+    rng.seed(seed);
+}
+
+char* dtostrf(double v, signed char width, unsigned char prec, char* out) {
+    sprintf(out, "%*.*f", width, prec, v);
+    return out;
+}
+
+int Stream::timedRead() {
+    unsigned long start = millis();
+    do {
+        int c = read();
+        if (c >= 0) return c;
+        if (available() <= 0 && timeout == 0) break;
+        yield();
+    } while (millis() - start < timeout);
+    return -1;
+}
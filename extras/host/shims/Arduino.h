@@ -0,0 +1,194 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the library on a desktop.
+// Not a general-purpose port: only what src/ and ArduinoJson use.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <strings.h>
+#include <string>
+
+typedef uint8_t byte;
+
+class String {
+public:
+    String() {}
+    String(const char* c) : s(c ? c : "") {}
+    String(const String& o) = default;
+    String(String&& o) = default;
+    explicit String(char c) : s(1, c) {}
+    explicit String(int v) : s(std::to_string(v)) {}
+    explicit String(unsigned int v) : s(std::to_string(v)) {}
+    explicit String(long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long v) : s(std::to_string(v)) {}
+    explicit String(long long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long long v) : s(std::to_string(v)) {}
+    explicit String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+    explicit String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+    String& operator=(const String& o) = default;
+    String& operator=(String&& o) = default;
+    String& operator=(const char* c) { s = c ? c : ""; return *this; }
+
+    unsigned int length() const { return s.size(); }
+    const char* c_str() const { return s.c_str(); }
+    bool reserve(unsigned int n) { s.reserve(n); return true; }
+    char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char& operator[](unsigned int i) { return s[i]; }
+
+    bool concat(const String& o) { s += o.s; return true; }
+    bool concat(const char* c) { if (c) s += c; return true; }
+    bool concat(const char* c, unsigned int n) { s.append(c, n); return true; }
+    bool concat(char c) { s += c; return true; }
+    bool concat(int v) { s += std::to_string(v); return true; }
+    bool concat(unsigned int v) { s += std::to_string(v); return true; }
+    bool concat(long v) { s += std::to_string(v); return true; }
+    bool concat(unsigned long v) { s += std::to_string(v); return true; }
+    template <typename T> String& operator+=(const T& v) { concat(v); return *this; }
+
+    bool equals(const String& o) const { return s == o.s; }
+    bool equalsIgnoreCase(const String& o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+    bool operator==(const String& o) const { return s == o.s; }
+    bool operator==(const char* c) const { return s == (c ? c : ""); }
+    bool operator!=(const String& o) const { return s != o.s; }
+    bool operator!=(const char* c) const { return !(*this == c); }
+    bool operator<(const String& o) const { return s < o.s; }
+    bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool endsWith(const String& p) const {
+        return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return pos(s.find(c, from)); }
+    int indexOf(const String& p, unsigned int from = 0) const { return pos(s.find(p.s, from)); }
+    int lastIndexOf(char c) const { return pos(s.rfind(c)); }
+    String substring(unsigned int from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (to > s.size()) to = s.size();
+        return from < to ? String(s.substr(from, to - from)) : String();
+    }
+
+    void remove(unsigned int i) { if (i < s.size()) s.erase(i); }
+    void remove(unsigned int i, unsigned int n) { if (i < s.size()) s.erase(i, n); }
+    void trim() {
+        size_t a = s.find_first_not_of(" \t\r\n");
+        size_t b = s.find_last_not_of(" \t\r\n");
+        s = a == std::string::npos ? std::string() : s.substr(a, b - a + 1);
+    }
+    void toLowerCase() { for (auto &c : s) c = tolower((unsigned char)c); }
+    void toUpperCase() { for (auto &c : s) c = toupper((unsigned char)c); }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+
+private:
+    std::string s;
+    explicit String(std::string&& x) : s(std::move(x)) {}
+    static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+    void fromDouble(double v, unsigned int decimals) {
+        char b[48];
+        snprintf(b, sizeof(b), "%.*f", (int)decimals, v);
+        s = b;
+    }
+};
+
+// result type of operator+, as in the Arduino core (ArduinoJson knows it)
+class StringSumHelper : public String {
+public:
+    StringSumHelper(const String& s) : String(s) {}
+};
+
+template <typename T> StringSumHelper operator+(const String& a, const T& b) {
+    StringSumHelper r(a);
+    r.concat(b);
+    return r;
+}
+inline StringSumHelper operator+(const char* a, const String& b) {
+    StringSumHelper r{String(a)};
+    r.concat(b);
+    return r;
+}
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* b, size_t n) {
+        size_t k = 0;
+        while (k < n && write(b[k])) k++;
+        return k;
+    }
+    size_t write(const char* b, size_t n) { return write((const uint8_t*)b, n); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t println(const String& s) { return print(s) + print("\r\n"); }
+    size_t println(const char* s = "") { return print(s) + print("\r\n"); }
+    virtual void flush() {}
+};
+
+unsigned long millis();
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long ms) { timeout = ms; }
+    size_t readBytes(char* buf, size_t n) {
+        size_t k = 0;
+        while (k < n) {
+            int c = timedRead();
+            if (c < 0) break;
+            buf[k++] = (char)c;
+        }
+        return k;
+    }
+    size_t readBytes(uint8_t* buf, size_t n) { return readBytes((char*)buf, n); }
+    String readString() {
+        String r;
+        for (int c = timedRead(); c >= 0; c = timedRead()) r += (char)c;
+        return r;
+    }
+    String readStringUntil(char end) {
+        String r;
+        for (int c = timedRead(); c >= 0 && c != end; c = timedRead()) r += (char)c;
+        return r;
+    }
+
+protected:
+    unsigned long timeout = 1000;
+    int timedRead();
+};
+
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+char* dtostrf(double v, signed char width, unsigned char prec, char* out);
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// heap figures come from the counting operator new in Arduino.cpp
+class EspClass {
+public:
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+};
+extern EspClass ESP;
+
+// host-only: allocation counters since start (all threads)
+namespace host {
+size_t allocCount();
+size_t allocBytes();
+size_t liveBytes();
+}
+
+#endif
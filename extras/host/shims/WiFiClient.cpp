@@ -0,0 +1,112 @@
+#include "WiFiClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+WiFiClass WiFi;
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    stop();
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return 0;
+
+    for (addrinfo* a = res; a && fd < 0; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            pending = false;
+        } else if (errno == EINPROGRESS) {
+            pending = true; // settle() finds out how it ended
+        } else {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    eof = false;
+    head = tail = 0;
+    return fd >= 0 ? 1 : 0;
+}
+
+// false while the handshake is still running; a failed one closes the socket
+bool WiFiClient::settle() {
+    if (fd < 0) return false;
+    if (!pending) return true;
+    pollfd p = { fd, POLLOUT, 0 };
+    if (::poll(&p, 1, 0) != 1) return false;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        stop();
+        return false;
+    }
+    pending = false;
+    return true;
+}
+
+void WiFiClient::stop() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    pending = false;
+    head = tail = 0;
+}
+
+size_t WiFiClient::write(const uint8_t* b, size_t n) {
+    if (!settle()) return 0;
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t k = ::send(fd, b + sent, n - sent, MSG_NOSIGNAL);
+        if (k > 0) { sent += k; continue; }
+        if (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK) stop();
+        break;
+    }
+    return sent;
+}
+
+// pull whatever the kernel has into buf, without waiting
+bool WiFiClient::fill() {
+    if (head < tail) return true;
+    if (eof || !settle()) return false;
+    ssize_t k = ::recv(fd, buf, sizeof(buf), 0);
+    if (k > 0) {
+        head = 0;
+        tail = k;
+        return true;
+    }
+    if (k == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) eof = true;
+    return false;
+}
+
+int WiFiClient::available() {
+    fill();
+    return tail - head;
+}
+
+int WiFiClient::read() {
+    return fill() ? buf[head++] : -1;
+}
+
+int WiFiClient::peek() {
+    return fill() ? buf[head] : -1;
+}
+
+uint8_t WiFiClient::connected() {
+    if (fd < 0) return 0;
+    if (!settle()) return fd >= 0; // still connecting counts
+    fill();
+    return head < tail || !eof;
+}
@@ -0,0 +1,56 @@
+#ifndef HOST_WIFICLIENT_H
+#define HOST_WIFICLIENT_H
+
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+
+class Client : public Stream {
+public:
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() { return connected(); }
+};
+
+// TCP client over POSIX sockets. Nothing waits, so one thread can drive
+// thousands of them: connect() only starts the handshake, write() sends what
+// the socket takes now (0 while the handshake is still running), available()
+// reports what has arrived and read() returns -1 when nothing has. A failed
+// handshake shows up as connected() going false.
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+    ~WiFiClient() { stop(); }
+    WiFiClient(const WiFiClient&) = delete;
+    WiFiClient& operator=(const WiFiClient&) = delete;
+
+    int connect(const char* host, uint16_t port) override;
+    void stop() override;
+    uint8_t connected() override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* b, size_t n) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+    void setNoDelay(bool) {} // always on
+
+private:
+    int fd = -1;
+    bool pending = false; // handshake not finished yet
+    bool eof = false;
+    uint8_t buf[1460];
+    size_t head = 0;
+    size_t tail = 0;
+
+    bool fill();
+    bool settle();
+};
+
+class WiFiClass {
+public:
+    int status() { return WL_CONNECTED; }
+};
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,131 @@
+#include "AsyncHttp.h"
+
+void AsyncHttp::start(const String& h, uint16_t p, const String& method, const String& path,
+                      const String& headers, const String& body) {
+    reset();
+    host = h;
+    port = p;
+
+    // HTTP/1.0 so the server never answers with chunked encoding
+    request = method + " " + path + " HTTP/1.0\r\n";
+    request += "Host: " + host + "\r\n";
+    request += headers;
+    request += "Content-Length: " + String((unsigned long)body.length()) + "\r\n";
+    request += "Connection: close\r\n\r\n";
+    request += body;
+
+    startedAt = millis();
+    st = CONNECT;
+}
+
+void AsyncHttp::reset() {
+    client->stop();
+    st = IDLE;
+    raw = "";
+    request = "";
+    requestSent = 0;
+    sentTime = 0;
+    firstByteTime = 0;
+    respBody = "";
+    respHeaders = "";
+    headerEnd = -1;
+    contentLength = -1;
+    statusCode = 0;
+}
+
+void AsyncHttp::fail() {
+    client->stop();
+    st = FAILED;
+}
+
+AsyncHttp::State AsyncHttp::poll() {
+    if (st != IDLE && st != DONE && st != FAILED && millis() - startedAt >= timeout) {
+        fail();
+        return st;
+    }
+
+    switch (st) {
+        case CONNECT:
+            if (!client->connect(host.c_str(), port)) { fail(); break; }
+            st = SEND;
+            break;
+
+        case SEND: {
+            size_t n = client->write((const uint8_t*)request.c_str() + requestSent,
+                                     request.length() - requestSent);
+            if (n == 0 && !client->connected()) { fail(); break; }
+            requestSent += n;
+            if (requestSent < request.length()) break; // socket full, go on next poll
+            request = "";
+            sentTime = millis() | 1;
+            st = AWAIT;
+            break;
+        }
+
+        case AWAIT: {
+            size_t n = 0;
+            while (n < readChunk && client->available() > 0) {
+                int c = client->read();
+                if (c < 0) break;
+                raw += (char)c;
+                n++;
+            }
+            if (n > 0 && firstByteTime == 0) firstByteTime = millis() | 1;
+            if (raw.length() > maxResponse) { fail(); break; }
+            if (headerEnd < 0) parseHeaders();
+            bool complete = headerEnd >= 0 && contentLength >= 0 &&
+                            (long)(raw.length() - headerEnd) >= contentLength;
+            if (complete || (!client->connected() && client->available() <= 0)) st = PARSE;
+            break;
+        }
+
+        case PARSE:
+            client->stop();
+            if (headerEnd < 0) parseHeaders();
+            if (headerEnd < 0 || statusCode <= 0) { fail(); break; }
+            respHeaders = raw.substring(raw.indexOf("\r\n") + 2, headerEnd - 2);
+            respBody = raw.substring(headerEnd);
+            if (contentLength >= 0 && (long)respBody.length() > contentLength) {
+                respBody.remove(contentLength);
+            }
+            raw = "";
+            st = DONE;
+            break;
+
+        default:
+            break;
+    }
+    return st;
+}
+
+void AsyncHttp::parseHeaders() {
+    int end = raw.indexOf("\r\n\r\n");
+    if (end < 0) return;
+    headerEnd = end + 4;
+
+    // "HTTP/1.1 200 OK"
+    int sp = raw.indexOf(' ');
+    if (sp > 0 && sp < end) statusCode = raw.substring(sp + 1).toInt();
+
+    String head = raw.substring(0, end);
+    head.toLowerCase();
+    int cl = head.indexOf("\r\ncontent-length:");
+    if (cl >= 0) contentLength = head.substring(cl + 17).toInt();
+}
+
+String AsyncHttp::header(const char* name) const {
+    String key = String(name) + ":";
+    int pos = 0;
+    while (pos < (int)respHeaders.length()) {
+        int eol = respHeaders.indexOf("\r\n", pos);
+        if (eol < 0) eol = respHeaders.length();
+        String line = respHeaders.substring(pos, eol);
+        if (line.length() > key.length() && line.substring(0, key.length()).equalsIgnoreCase(key)) {
+            String v = line.substring(key.length());
+            v.trim();
+            return v;
+        }
+        pos = eol + 2;
+    }
+    return "";
+}
@@ -0,0 +1,81 @@
+#ifndef ASYNC_HTTP_H
+#define ASYNC_HTTP_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#ifndef IOT_ASYNC_READ_CHUNK
+#define IOT_ASYNC_READ_CHUNK 256 // response bytes consumed per poll()
+#endif
+
+// Minimal HTTP/1.0 client split into small steps so a request can be driven
+// from loop() without waiting on the network. Each poll() does one bounded
+// piece of work: connect -> send -> await (read what is available) -> parse.
+//
+// Note: WiFiClient::connect() itself blocks until the TCP handshake is done
+// (bounded by the core's connect timeout), and a WiFiClientSecure until the
+// TLS handshake is; every later step returns at once. A client whose connect()
+// returns before the handshake ends (the host shim) is simply written to
+// again on the next poll until it takes the whole request.
+class AsyncHttp {
+public:
+    enum State { IDLE, CONNECT, SEND, AWAIT, PARSE, DONE, FAILED };
+
+    // socket to use, e.g. a WiFiClientSecure for https (nullptr = the plain
+    // one owned by this object). change it only while idle
+    void setClient(WiFiClient* c) { client = c ? c : &plain; }
+
+    // overall timeout for one request (ms)
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+    // headers: extra header lines, each terminated by "\r\n"
+    void start(const String& host, uint16_t port, const String& method, const String& path,
+               const String& headers, const String& body);
+
+    // advance the request by one step and return the new state
+    State poll();
+
+    State state() const { return st; }
+    int status() const { return statusCode; }
+    const String& body() const { return respBody; }
+    // value of a response header (case-insensitive name), "" if absent
+    String header(const char* name) const;
+
+    // millis() when the last request byte was written and when the first
+    // response byte was read, 0 until then. their difference is the server's
+    // share of the request, without connect time or polling delay before send
+    unsigned long sentAt() const { return sentTime; }
+    unsigned long firstByteAt() const { return firstByteTime; }
+    // abort the current request and close the socket
+    void reset();
+
+private:
+    WiFiClient plain;
+    WiFiClient* client = &plain;
+    State st = IDLE;
+
+    String host;
+    uint16_t port = 80;
+    String request;
+    size_t requestSent = 0;   // bytes of request written so far
+
+    String raw;               // status line + headers + body as received
+    int headerEnd = -1;       // offset of body in raw, -1 until headers are complete
+    long contentLength = -1;  // -1 = read until the server closes
+    int statusCode = 0;
+    String respBody;
+    String respHeaders;       // header block of the last response, without the status line
+
+    unsigned long startedAt = 0;
+    unsigned long sentTime = 0;
+    unsigned long firstByteTime = 0;
+    unsigned long timeout = 5000UL;
+
+    static const size_t readChunk = IOT_ASYNC_READ_CHUNK;
+    static const size_t maxResponse = 8192; // larger responses are rejected
+
+    void fail();
+    void parseHeaders();
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "CircuitBreaker.h"
+
+void CircuitBreaker::configure(unsigned long baseMs, unsigned long maxMs, uint8_t failThreshold) {
+    base = baseMs > 0 ? baseMs : 1;
+    cap = maxMs > base ? maxMs : base;
+    threshold = failThreshold > 0 ? failThreshold : 1;
+    st = CLOSED;
+    failures = 0;
+    coolDown = 0;
+}
+
+bool CircuitBreaker::allow() {
+    if (st == CLOSED) return true;
+    if (st == HALF_OPEN) return false; // one probe at a time
+    if (millis() - openedAt < wait) return false;
+    st = HALF_OPEN;
+    return true;
+}
+
+void CircuitBreaker::record(int status) {
+    if (status > 0 && status < 500 && status != 429) {
+        st = CLOSED;
+        failures = 0;
+        coolDown = 0;
+        return;
+    }
+    if (failures < 255) failures++;
+    if (st == HALF_OPEN || failures >= threshold) open();
+}
+
+void CircuitBreaker::open() {
+    coolDown = coolDown == 0 ? 1000UL : coolDown * 2;
+    if (coolDown > cap) coolDown = cap;
+    wait = coolDown + random(coolDown / 2 + 1);
+    openedAt = millis();
+    st = OPEN;
+}
+
+unsigned long CircuitBreaker::retryDelay(int attempt) const {
+    unsigned long d = base;
+    for (int i = 1; i < attempt && d < cap; i++) d *= 2;
+    if (d > cap) d = cap;
+    return d / 2 + random(d / 2 + 1);
+}
@@ -0,0 +1,45 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <Arduino.h>
+
+// Retry policy shared by every request of one client: exponential backoff
+// with jitter between attempts, and a circuit breaker that stops touching the
+// network while the server is known to be down.
+//
+// CLOSED: requests go out. `threshold` consecutive failed attempts open it.
+// OPEN: requests fail at once. after the cool-down one probe is let through.
+// HALF_OPEN: the probe is in flight; success closes, failure reopens with a
+// doubled cool-down (1 s up to maxMs, plus jitter).
+class CircuitBreaker {
+public:
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    void configure(unsigned long baseMs, unsigned long maxMs, uint8_t failThreshold);
+
+    // may an attempt start now?
+    bool allow();
+    // outcome of one attempt: an HTTP status, <= 0 for a transport error.
+    // no answer, 5xx and 429 count as failures; anything else means the server is up
+    void record(int status);
+
+    // wait before retry number `attempt` (1-based): base doubling up to max,
+    // randomized over its upper half so devices drift apart
+    unsigned long retryDelay(int attempt) const;
+
+    State state() const { return st; }
+
+private:
+    State st = CLOSED;
+    uint8_t failures = 0;          // consecutive failed attempts
+    uint8_t threshold = 3;
+    unsigned long base = 200UL;
+    unsigned long cap = 60000UL;
+    unsigned long coolDown = 0;    // current open period before jitter
+    unsigned long wait = 0;        // open period with jitter
+    unsigned long openedAt = 0;
+
+    void open();
+};
+
+#endif
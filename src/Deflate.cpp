@@ -0,0 +1,355 @@
+#include "Deflate.h"
+
+namespace {
+
+// length codes 257..285 and distance codes 0..29: base value and extra bits
+const uint16_t lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                               35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                8193, 12289, 16385, 24577 };
+const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+const uint32_t adlerMod = 65521;
+
+}
+
+// Decoder
+InflateStream::InflateStream(Stream& src, uint8_t* buf, uint8_t bits)
+: in(src), window(buf), mask((1UL << bits) - 1), windowBits(bits) {
+    // end of output is final; don't wait for more
+    setTimeout(0);
+}
+
+int InflateStream::read() {
+    if (ahead >= 0) {
+        int c = ahead;
+        ahead = -1;
+        return c;
+    }
+    return produce();
+}
+
+int InflateStream::peek() {
+    if (ahead < 0) ahead = produce();
+    return ahead;
+}
+
+// n bits, least significant first; input running out fails the stream
+uint32_t InflateStream::bits(uint8_t n) {
+    while (bitCount < n) {
+        uint8_t c;
+        if (in.readBytes(&c, 1) != 1) { st = FAILED; return 0; }
+        bitBuf |= (uint32_t)c << bitCount;
+        bitCount += 8;
+    }
+    uint32_t v = bitBuf & ((1UL << n) - 1);
+    bitBuf >>= n;
+    bitCount -= n;
+    return v;
+}
+
+// one symbol, reading the code bit by bit (as in zlib's puff.c)
+int InflateStream::decode(const Huffman& h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= bits(1);
+        if (st == FAILED) return -1;
+        int count = h.counts[len];
+        if (code - count < first) return h.symbols[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool InflateStream::build(Huffman& h, const uint8_t* lengths, size_t n) {
+    memset(h.counts, 0, sizeof(h.counts));
+    for (size_t i = 0; i < n; i++) h.counts[lengths[i]]++;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - h.counts[len];
+        if (left < 0) return false; // over-subscribed
+    }
+    uint16_t offs[16];
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + h.counts[len];
+    for (size_t i = 0; i < n; i++) {
+        if (lengths[i] != 0) h.symbols[offs[lengths[i]]++] = i;
+    }
+    return true;
+}
+
+void InflateStream::fixedTables() {
+    uint8_t lengths[288];
+    for (int i = 0; i < 144; i++) lengths[i] = 8;
+    for (int i = 144; i < 256; i++) lengths[i] = 9;
+    for (int i = 256; i < 280; i++) lengths[i] = 7;
+    for (int i = 280; i < 288; i++) lengths[i] = 8;
+    build(lit, lengths, 288);
+    for (int i = 0; i < 30; i++) lengths[i] = 5;
+    build(dist, lengths, 30);
+}
+
+bool InflateStream::readDynamic() {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    size_t nlen = bits(5) + 257;
+    size_t ndist = bits(5) + 1;
+    size_t ncode = bits(4) + 4;
+    if (st == FAILED || nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[286 + 30] = {};
+    for (size_t i = 0; i < ncode; i++) lengths[order[i]] = bits(3);
+    // the code length code is built in `lit`, which is rebuilt below
+    if (st == FAILED || !build(lit, lengths, 19)) return false;
+
+    size_t index = 0;
+    while (index < nlen + ndist) {
+        int sym = decode(lit);
+        if (sym < 0) return false;
+        if (sym < 16) {
+            lengths[index++] = sym;
+            continue;
+        }
+        uint8_t len = 0;
+        size_t repeat;
+        if (sym == 16) {
+            if (index == 0) return false;
+            len = lengths[index - 1];
+            repeat = 3 + bits(2);
+        } else if (sym == 17) {
+            repeat = 3 + bits(3);
+        } else {
+            repeat = 11 + bits(7);
+        }
+        if (st == FAILED || index + repeat > nlen + ndist) return false;
+        while (repeat--) lengths[index++] = len;
+    }
+    if (lengths[256] == 0) return false; // no end-of-block code
+    return build(lit, lengths, nlen) && build(dist, lengths + nlen, ndist);
+}
+
+int InflateStream::emit(uint8_t b) {
+    window[pos & mask] = b;
+    pos++;
+    s1 += b;
+    if (s1 >= adlerMod) s1 -= adlerMod;
+    s2 += s1;
+    if (s2 >= adlerMod) s2 -= adlerMod;
+    return b;
+}
+
+// next output byte, -1 at the end of the stream or on an error
+int InflateStream::produce() {
+    while (true) {
+        switch (st) {
+            case HEADER: {
+                uint32_t cmf = bits(8);
+                uint32_t flg = bits(8);
+                if (st == FAILED) return -1;
+                // method 8 (deflate), valid check bits, no preset dictionary
+                if ((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20)) return fail();
+                if ((cmf >> 4) + 8 > windowBits) {
+                    windowTooLarge = true;
+                    return fail();
+                }
+                st = BLOCK;
+                break;
+            }
+            case BLOCK: {
+                if (lastBlock) { st = TRAILER; break; }
+                lastBlock = bits(1);
+                uint32_t type = bits(2);
+                if (st == FAILED) return -1;
+                if (type == 0) {
+                    // stored: skip to the byte boundary (bitCount < 8)
+                    bitBuf = 0;
+                    bitCount = 0;
+                    uint32_t len = bits(16);
+                    uint32_t nlen = bits(16);
+                    if (st == FAILED) return -1;
+                    if (len != (~nlen & 0xffff)) return fail();
+                    stored = len;
+                    st = STORED;
+                } else if (type == 1) {
+                    fixedTables();
+                    st = CODES;
+                } else if (type == 2) {
+                    if (!readDynamic()) return fail();
+                    st = CODES;
+                } else {
+                    return fail();
+                }
+                break;
+            }
+            case STORED: {
+                if (stored == 0) { st = BLOCK; break; }
+                uint8_t b = bits(8);
+                if (st == FAILED) return -1;
+                stored--;
+                return emit(b);
+            }
+            case CODES: {
+                if (copyLen > 0) {
+                    copyLen--;
+                    return emit(window[(pos - copyDist) & mask]);
+                }
+                int sym = decode(lit);
+                if (sym < 0) return fail();
+                if (sym < 256) return emit(sym);
+                if (sym == 256) { st = BLOCK; break; }
+                sym -= 257;
+                if (sym >= 29) return fail();
+                size_t len = lenBase[sym] + bits(lenExtra[sym]);
+                int d = decode(dist);
+                if (d < 0 || d >= 30) return fail();
+                size_t back = distBase[d] + bits(distExtra[d]);
+                if (st == FAILED) return -1;
+                if (back > pos || back > mask + 1) return fail();
+                copyLen = len;
+                copyDist = back;
+                break;
+            }
+            case TRAILER: {
+                bitBuf = 0;
+                bitCount = 0;
+                uint32_t sum = 0;
+                for (int i = 0; i < 4; i++) sum = (sum << 8) | bits(8);
+                if (st == FAILED) return -1;
+                if (sum != ((s2 << 16) | s1)) return fail();
+                st = END;
+                return -1;
+            }
+            default:
+                return -1;
+        }
+    }
+}
+
+// Encoder: greedy LZ77 over hash chains, fixed Huffman codes
+namespace {
+
+const size_t encWindow = 1024; // zlib header says so (CINFO 2)
+const size_t hashSize = 1024;
+const int maxChain = 16;
+const size_t maxMatch = 258;
+
+struct BitWriter {
+    std::vector<uint8_t>& out;
+    uint32_t buf = 0;
+    uint8_t count = 0;
+
+    explicit BitWriter(std::vector<uint8_t>& o) : out(o) {}
+    void put(uint32_t v, uint8_t n) {
+        buf |= v << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back(buf & 0xff);
+            buf >>= 8;
+            count -= 8;
+        }
+    }
+    // Huffman codes are packed most significant bit first
+    void code(uint32_t c, uint8_t n) {
+        uint32_t r = 0;
+        for (uint8_t i = 0; i < n; i++) {
+            r = (r << 1) | (c & 1);
+            c >>= 1;
+        }
+        put(r, n);
+    }
+    void flush() {
+        if (count > 0) out.push_back(buf & 0xff);
+        buf = 0;
+        count = 0;
+    }
+};
+
+void literal(BitWriter& w, int sym) {
+    if (sym < 144) w.code(0x30 + sym, 8);
+    else if (sym < 256) w.code(0x190 + sym - 144, 9);
+    else if (sym < 280) w.code(sym - 256, 7);
+    else w.code(0xc0 + sym - 280, 8);
+}
+
+void match(BitWriter& w, size_t len, size_t back) {
+    int l = 28;
+    while (lenBase[l] > len) l--;
+    literal(w, 257 + l);
+    w.put(len - lenBase[l], lenExtra[l]);
+    int d = 29;
+    while (distBase[d] > back) d--;
+    w.code(d, 5);
+    w.put(back - distBase[d], distExtra[d]);
+}
+
+size_t hash3(const uint8_t* p) {
+    return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (hashSize - 1);
+}
+
+}
+
+bool deflateZlib(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+    if (len >= 0xffff) return false; // positions are kept in 16 bits
+    out.clear();
+    out.reserve(len / 2 + 16);
+    out.push_back(0x28); // deflate, 1 KB window
+    out.push_back(0x15); // check bits, no dictionary, default level
+
+    // head: latest position + 1 per hash, prev: the one before it per window slot
+    std::vector<uint16_t> head(hashSize, 0);
+    std::vector<uint16_t> prev(encWindow, 0);
+    BitWriter w(out);
+    w.put(1, 1); // final block
+    w.put(1, 2); // fixed codes
+
+    size_t i = 0;
+    while (i < len) {
+        size_t best = 0, bestBack = 0;
+        if (i + 3 <= len) {
+            size_t h = hash3(data + i);
+            size_t limit = len - i < maxMatch ? len - i : maxMatch;
+            uint16_t cand = head[h];
+            for (int chain = 0; cand != 0 && chain < maxChain; chain++) {
+                size_t p = cand - 1;
+                if (i - p > encWindow) break;
+                size_t n = 0;
+                while (n < limit && data[p + n] == data[i + n]) n++;
+                if (n > best) {
+                    best = n;
+                    bestBack = i - p;
+                    if (n == limit) break;
+                }
+                uint16_t next = prev[p & (encWindow - 1)];
+                if (next == 0 || next - 1u >= p) break; // slot reused by a newer position
+                cand = next;
+            }
+        }
+        size_t step = best >= 3 ? best : 1;
+        if (best >= 3) match(w, best, bestBack);
+        else literal(w, data[i]);
+        // index every position covered, so later matches can start inside this one
+        for (size_t k = i; k < i + step && k + 3 <= len; k++) {
+            size_t h = hash3(data + k);
+            prev[k & (encWindow - 1)] = head[h];
+            head[h] = k + 1;
+        }
+        i += step;
+        if (out.size() >= len) return false; // not worth it
+    }
+    literal(w, 256);
+    w.flush();
+
+    uint32_t s1 = 1, s2 = 0;
+    for (size_t k = 0; k < len; k++) {
+        s1 = (s1 + data[k]) % adlerMod;
+        s2 = (s2 + s1) % adlerMod;
+    }
+    uint32_t sum = (s2 << 16) | s1;
+    for (int k = 3; k >= 0; k--) out.push_back((sum >> (8 * k)) & 0xff);
+    return out.size() < len;
+}
@@ -0,0 +1,66 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <Arduino.h>
+#include <vector>
+
+// zlib-wrapped deflate (RFC 1950 / 1951), the "deflate" HTTP content coding.
+
+// Streaming decoder: compressed bytes are pulled from `in` as the reader
+// asks for output, so a parser reading from it never holds the whole body.
+// Back-references are resolved from `window` (1 << windowBits bytes); a
+// stream whose header asks for a larger window fails with tooLarge() set.
+class InflateStream : public Stream {
+public:
+    InflateStream(Stream& in, uint8_t* window, uint8_t windowBits);
+
+    int available() override { return peek() >= 0 ? 1 : 0; }
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t) override { return 0; }
+
+    bool failed() const { return st == FAILED; }
+    bool finished() const { return st == END; } // checksum verified
+    bool tooLarge() const { return windowTooLarge; }
+
+private:
+    // canonical Huffman code: symbols ordered by code, code counts per length
+    struct Huffman {
+        uint16_t counts[16];
+        uint16_t symbols[288];
+    };
+    enum State { HEADER, BLOCK, STORED, CODES, TRAILER, END, FAILED };
+
+    Stream& in;
+    uint8_t* window;
+    size_t mask;
+    uint8_t windowBits;
+    State st = HEADER;
+    bool lastBlock = false;
+    bool windowTooLarge = false;
+    uint32_t bitBuf = 0;
+    uint8_t bitCount = 0;     // always < 8 between calls to bits()
+    size_t pos = 0;           // bytes produced so far
+    size_t stored = 0;        // STORED: bytes left in the block
+    size_t copyLen = 0;       // CODES: bytes left of the current match
+    size_t copyDist = 0;
+    uint32_t s1 = 1, s2 = 0;  // adler-32 of the output
+    int ahead = -1;           // byte decoded by peek()
+    Huffman lit;
+    Huffman dist;
+
+    int produce();
+    uint32_t bits(uint8_t n);
+    int decode(const Huffman& h);
+    static bool build(Huffman& h, const uint8_t* lengths, size_t n);
+    bool readDynamic();
+    void fixedTables();
+    int emit(uint8_t b);
+    int fail() { st = FAILED; return -1; }
+};
+
+// compress len bytes into out (zlib format, fixed Huffman codes, 1 KB window).
+// false if the input is over 64 KB or doesn't get smaller
+bool deflateZlib(const uint8_t* data, size_t len, std::vector<uint8_t>& out);
+
+#endif
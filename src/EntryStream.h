@@ -0,0 +1,124 @@
+#ifndef ENTRY_STREAM_H
+#define ENTRY_STREAM_H
+
+#include <Arduino.h>
+
+// Pass-through Stream that follows the structure of the one JSON or
+// MessagePack value read through it. When a parse into a small document
+// gives up halfway (NoMemory on a long string), skipRest() consumes what is
+// left of that value, so the surrounding list can go on with the next one.
+class EntryStream : public Stream {
+public:
+    EntryStream(Stream& src, bool msgpack) : in(src), packed(msgpack) {
+        setTimeout(0); // the source does the waiting
+    }
+
+    int available() override { return in.available(); }
+    int read() override {
+        char c;
+        if (in.readBytes(&c, 1) != 1) return -1;
+        track((uint8_t)c);
+        return (uint8_t)c;
+    }
+    int peek() override { return in.peek(); }
+    size_t write(uint8_t) override { return 0; }
+    void flush() {}
+
+    // true once the value has been read to its end
+    bool complete() const {
+        if (packed) return items == 0 && lenBytes == 0 && skip == 0;
+        return started && depth == 0;
+    }
+    // read up to the end of the value; false if the source runs out first
+    bool skipRest() {
+        while (!complete()) {
+            if (read() < 0) return false;
+        }
+        return true;
+    }
+
+private:
+    enum LenKind { RAW, EXT, ARRAY, MAP };
+
+    Stream& in;
+    bool packed;
+    // JSON
+    int depth = 0;
+    bool started = false;
+    bool inString = false;
+    bool escaped = false;
+    // MessagePack
+    uint32_t items = 1;    // values still to start
+    uint32_t skip = 0;     // payload bytes of the current value still to come
+    uint8_t lenBytes = 0;  // length field bytes still to come
+    uint32_t len = 0;
+    LenKind lenKind = RAW;
+
+    void track(uint8_t c) {
+        if (packed) trackPacked(c);
+        else trackJson(c);
+    }
+
+    void trackJson(uint8_t c) {
+        if (inString) {
+            if (escaped) escaped = false;
+            else if (c == '\\') escaped = true;
+            else if (c == '"') inString = false;
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+            started = true;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        }
+    }
+
+    void lengthField(uint8_t bytes, LenKind kind) {
+        lenBytes = bytes;
+        lenKind = kind;
+        len = 0;
+    }
+
+    void trackPacked(uint8_t c) {
+        if (skip > 0) { skip--; return; }
+        if (lenBytes > 0) {
+            len = (len << 8) | c;
+            if (--lenBytes > 0) return;
+            if (lenKind == RAW) skip = len;
+            else if (lenKind == EXT) skip = len + 1; // type byte
+            else items += lenKind == MAP ? 2 * len : len;
+            return;
+        }
+        // a header byte starts the next value
+        items--;
+        if (c <= 0x7f || c >= 0xe0 || c == 0xc0 || c == 0xc2 || c == 0xc3) return;
+        if ((c & 0xf0) == 0x80) { items += 2 * (c & 0x0f); return; }
+        if ((c & 0xf0) == 0x90) { items += c & 0x0f; return; }
+        if ((c & 0xe0) == 0xa0) { skip = c & 0x1f; return; }
+        switch (c) {
+            case 0xc4: case 0xd9: lengthField(1, RAW); break;
+            case 0xc5: case 0xda: lengthField(2, RAW); break;
+            case 0xc6: case 0xdb: lengthField(4, RAW); break;
+            case 0xc7: lengthField(1, EXT); break;
+            case 0xc8: lengthField(2, EXT); break;
+            case 0xc9: lengthField(4, EXT); break;
+            case 0xdc: lengthField(2, ARRAY); break;
+            case 0xdd: lengthField(4, ARRAY); break;
+            case 0xde: lengthField(2, MAP); break;
+            case 0xdf: lengthField(4, MAP); break;
+            case 0xcc: case 0xd0: skip = 1; break;
+            case 0xcd: case 0xd1: skip = 2; break;
+            case 0xca: case 0xce: case 0xd2: skip = 4; break;
+            case 0xcb: case 0xcf: case 0xd3: skip = 8; break;
+            case 0xd4: skip = 2; break; // fixext: type byte + data
+            case 0xd5: skip = 3; break;
+            case 0xd6: skip = 5; break;
+            case 0xd7: skip = 9; break;
+            case 0xd8: skip = 17; break;
+            default: break;
+        }
+    }
+};
+
+#endif
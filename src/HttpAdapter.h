@@ -0,0 +1,79 @@
+#ifndef HTTPADAPTER_H
+#define HTTPADAPTER_H
+
+#include "ITransportAdapter.h"
+#include <HTTPClient.h>
+#include <WiFiClient.h>
+
+// Plain HTTPClient transport. IOTServerClient already speaks HTTP on its own
+// (with keep-alive, fixed buffers and streaming parse); this adapter is the
+// reference implementation of ITransportAdapter and a starting point for
+// variants (other host, proxy, custom headers, ...).
+class HttpAdapter : public ITransportAdapter {
+public:
+    HttpAdapter(const String& baseUrl, const String& deviceKey)
+        : base(baseUrl), key(deviceKey) { if (base.endsWith("/")) base.remove(base.length() - 1); }
+
+    bool connect() override {
+        // nothing to do — ensure WiFi connected before use
+        return WiFi.status() == WL_CONNECTED;
+    }
+
+    String get(const String& endpoint, const String& headers = "") override {
+        Response r;
+        request("GET", endpoint, "", headers, r);
+        return r.body;
+    }
+
+    String post(const String& endpoint, const String& body, const String& headers = "") override {
+        Response r;
+        request("POST", endpoint, body, headers, r);
+        return r.body;
+    }
+
+    bool request(const String& method, const String& endpoint, const String& body,
+                 const String& headers, Response& out) override {
+        static const char* collect[] = { "ETag" };
+        HTTPClient http;
+        out = Response();
+        if (!http.begin(client, base + endpoint)) return false;
+        http.addHeader("X-DEVICE-KEY", key);
+        http.addHeader("Content-Type", "application/json");
+        addHeaders(http, headers);
+        http.collectHeaders(collect, 1);
+        // by length: a body may contain NUL bytes (MessagePack, deflate)
+        uint8_t* payload = (uint8_t*)body.c_str();
+        if (method == "GET") out.status = http.GET();
+        else if (method == "POST") out.status = http.POST(payload, body.length());
+        else out.status = http.sendRequest(method.c_str(), payload, body.length());
+        if (out.status >= 200 && out.status < 300) {
+            out.body = http.getString();
+            out.etag = http.header("ETag");
+        }
+        http.end();
+        return out.status > 0;
+    }
+
+private:
+    WiFiClient client;
+    String base;
+    String key;
+
+    // "Name: value\r\n..." -> addHeader()
+    static void addHeaders(HTTPClient& http, const String& headers) {
+        int pos = 0;
+        while (pos < (int)headers.length()) {
+            int eol = headers.indexOf("\r\n", pos);
+            if (eol < 0) eol = headers.length();
+            int colon = headers.indexOf(':', pos);
+            if (colon > pos && colon < eol) {
+                String value = headers.substring(colon + 1, eol);
+                value.trim();
+                http.addHeader(headers.substring(pos, colon), value);
+            }
+            pos = eol + 2;
+        }
+    }
+};
+
+#endif
@@ -1,12 +1,76 @@
 #include "IOTServerClient.h"
+#include "EntryStream.h"
+#include "MemStream.h"
+#include <new>
 
 IOTServerClient::IOTServerClient(const String& key, const String& url)
 : deviceKey(key), serverUrl(url) {
     if (serverUrl.endsWith("/")) serverUrl.remove(serverUrl.length() - 1);
+
+    // "http://host:port/base" -> host, port, basePath
+    String rest = serverUrl;
+    int scheme = rest.indexOf("://");
+    if (scheme >= 0) {
+        secure = rest.substring(0, scheme).equalsIgnoreCase("https");
+        if (secure) port = 443;
+        rest = rest.substring(scheme + 3);
+    }
+    int slash = rest.indexOf('/');
+    if (slash >= 0) {
+        basePath = rest.substring(slash);
+        rest = rest.substring(0, slash);
+    }
+    int colon = rest.indexOf(':');
+    if (colon >= 0) {
+        port = rest.substring(colon + 1).toInt();
+        rest = rest.substring(0, colon);
+    }
+    host = rest;
+
+#if IOT_ENABLE_TLS
+    if (secure) {
+        net = &tlsClient;
+        asyncHttp.setClient(&tlsAsyncClient);
+        // a handshake costs seconds, a request on an open connection milliseconds
+        keepAlive = true;
+        keepAliveIdle = 60000UL;
+        applyRequestTimeout();
+#if defined(ESP8266)
+        tlsClient.setSession(&tlsSession);
+        tlsAsyncClient.setSession(&tlsSession);
+#if IOT_TLS_BUFFER_SIZE > 0
+        tlsClient.setBufferSizes(IOT_TLS_BUFFER_SIZE, 512);
+        tlsAsyncClient.setBufferSizes(IOT_TLS_BUFFER_SIZE, 512);
+#endif
+#endif
+    }
+#endif
+
+#if IOT_MAX_VARIABLES > 0
+    // fixed-capacity profile: everything that would grow later is sized here
+    cache.reserve(IOT_MAX_VARIABLES, IOT_MAX_NAME_LENGTH, IOT_MAX_STRING_LENGTH);
+    callbacks.reserve(IOT_MAX_CALLBACKS);
+    deferred.reserve(IOT_MAX_VARIABLES);
+    pending.reserve(IOT_MAX_VARIABLES);
+    deviceWrites.reserve(IOT_MAX_VARIABLES);
+    gatewaySent.reserve(IOT_MAX_VARIABLES);
+    asyncQueue.reserve(asyncQueueMax + asyncCriticalReserve);
+    bulk.reserve(IOT_MAX_VARIABLES);
+    logDirty.reserve(IOT_MAX_VARIABLES);
+    scratch.s.reserve(IOT_MAX_STRING_LENGTH);
+    parseRevision.reserve(IOT_MAX_NAME_LENGTH);
+    syncRevision.reserve(IOT_MAX_NAME_LENGTH);
+#endif
 }
 
 bool IOTServerClient::begin() {
     lastHeartbeat = millis();
+    loadCacheLog();
+    loadOfflineQueue();
+    if (sleepCycle) {
+        loadSnapshot();
+        holdWrites = true;
+    }
     // library doesn't manage WiFi; caller must connect
     return true;
 }
@@ -16,19 +80,273 @@ bool IOTServerClient::isConnected() {
 }
 
 void IOTServerClient::setHeartbeatInterval(unsigned long ms) {
+    localHeartbeat = ms;
     heartbeatInterval = ms;
+    if (pollHint == 0) pollInterval = ms;
+}
+
+void IOTServerClient::setRemoteConfig(bool enabled) {
+    remoteConfig = enabled;
+}
+
+// ms from a directive into ms: null means the firmware's own value, a server
+// value is raised to at least floor. false (setting left alone) for anything
+// but a non-negative integer
+static bool directiveMs(JsonVariantConst v, unsigned long local, unsigned long floor, unsigned long& ms) {
+    if (v.isNull()) {
+        ms = local;
+        return true;
+    }
+    if (!v.is<unsigned long>()) return false;
+    ms = v.as<unsigned long>();
+    if (ms < floor) ms = floor;
+    return true;
+}
+
+// "config": { heartbeat?, batch?, bulk?, encoding?, vars?: { name: policy } }.
+// absent members leave the setting as it is, so directives add up over answers
+void IOTServerClient::applyConfig(JsonObjectConst c) {
+    if (!remoteConfig || c.isNull()) return;
+    // floors, whatever the server says: each of these paces requests from loop()
+    unsigned long ms;
+    if (c.containsKey("heartbeat") && directiveMs(c["heartbeat"], localHeartbeat, 1000UL, ms)) {
+        heartbeatInterval = ms;
+        if (pollHint == 0 && !adaptiveHeartbeat) pollInterval = heartbeatInterval;
+    }
+    if (c.containsKey("batch") && directiveMs(c["batch"], localBatchWindow, 0, ms)) {
+        // 0 turns the window off
+        batchWindow = ms == 0 || ms >= 100UL || c["batch"].isNull() ? ms : 100UL;
+    }
+    if (c.containsKey("bulk") && directiveMs(c["bulk"], localBulkInterval, 1000UL, ms)) bulkInterval = ms;
+    if (c.containsKey("encoding")) {
+        const char* e = c["encoding"] | "";
+        WireFormat f = c["encoding"].isNull() ? localWireFormat
+                     : strcmp(e, "msgpack") == 0 ? WIRE_MSGPACK : WIRE_JSON;
+        // gateway requests are JSON only
+        if (f != wireFormat && (f == WIRE_JSON || devices.empty())) {
+            wireFormat = f;
+            msgpackAccepted = false;
+        }
+    }
+    for (JsonPairConst kv : c["vars"].as<JsonObjectConst>()) applyVarConfig(kv.key().c_str(), kv.value());
+}
+
+// { mode?: "always" | "change" | "deadband", abs?, pct?, silence?, priority? };
+// a policy replaces the variable's current one, null resets it to always
+void IOTServerClient::applyVarConfig(const char* name, JsonVariantConst p) {
+    if (p.isNull()) {
+        clearWritePolicy(name);
+        return;
+    }
+    const char* mode = p["mode"] | (p.containsKey("abs") || p.containsKey("pct") ? "deadband" : "");
+    unsigned long silence = p["silence"] | 0UL;
+    if (strcmp(mode, "deadband") == 0) setDeadband(name, p["abs"] | 0.0f, p["pct"] | 0.0f, silence);
+    else if (strcmp(mode, "change") == 0) setOnChange(name, silence);
+    else if (strcmp(mode, "always") == 0) clearWritePolicy(name);
+
+    const char* prio = p["priority"] | "";
+    if (strcmp(prio, "critical") == 0) setPriority(name, PRIORITY_CRITICAL);
+    else if (strcmp(prio, "normal") == 0) setPriority(name, PRIORITY_NORMAL);
+    else if (strcmp(prio, "bulk") == 0) setPriority(name, PRIORITY_BULK);
+}
+
+// "config" member of a streamed answer
+bool IOTServerClient::readConfig(Stream& in) {
+    StaticJsonDocument<IOT_CONFIG_DOC_SIZE> doc;
+    if (!readMember(in, doc)) return false;
+    applyConfig(doc.as<JsonObjectConst>());
+    return true;
+}
+
+void IOTServerClient::setAdaptiveHeartbeat(bool enabled, unsigned long minPollMs, unsigned long maxPollMs) {
+    adaptiveHeartbeat = enabled;
+    pollMin = minPollMs;
+    pollMax = maxPollMs > minPollMs ? maxPollMs : minPollMs;
+    pollHint = 0;
+    pollInterval = constrain(heartbeatInterval, pollMin, pollMax);
+}
+
+void IOTServerClient::applyPollHint(unsigned long ms) {
+    pollHint = ms;
+    if (ms > 0) pollInterval = constrain(ms, pollMin, pollMax);
+}
+
+// poll sooner while the server side is changing, back off while it isn't
+void IOTServerClient::adaptPoll(bool changed) {
+    if (!adaptiveHeartbeat || pollHint > 0) return;
+    if (changed) {
+        pollInterval = pollMin;
+    } else {
+        pollInterval += pollInterval / 2;
+        if (pollInterval > pollMax) pollInterval = pollMax;
+    }
+}
+
+void IOTServerClient::setKeepAlive(bool enabled, unsigned long idleTimeoutMs) {
+    keepAlive = enabled;
+    keepAliveIdle = idleTimeoutMs;
+    if (!keepAlive) net->stop();
+}
+
+void IOTServerClient::setCACert(const char* pem) {
+#if IOT_ENABLE_TLS && defined(ESP8266)
+    trustAnchors.reset(new BearSSL::X509List(pem));
+    tlsClient.setTrustAnchors(trustAnchors.get());
+    tlsAsyncClient.setTrustAnchors(trustAnchors.get());
+#elif IOT_ENABLE_TLS
+    tlsClient.setCACert(pem);
+    tlsAsyncClient.setCACert(pem);
+#endif
+}
+
+bool IOTServerClient::setFingerprint(const uint8_t sha1[20]) {
+#if IOT_ENABLE_TLS && defined(ESP8266)
+    return tlsClient.setFingerprint(sha1) && tlsAsyncClient.setFingerprint(sha1);
+#else
+    return false;
+#endif
+}
+
+void IOTServerClient::setInsecure() {
+#if IOT_ENABLE_TLS
+    tlsClient.setInsecure();
+    tlsAsyncClient.setInsecure();
+#endif
+}
+
+void IOTServerClient::setAsync(bool enabled) {
+    asyncMode = enabled;
+}
+
+bool IOTServerClient::isBusy() {
+    return !asyncQueue.empty();
+}
+
+void IOTServerClient::onHeartbeatResult(ResultCallback cb) {
+    heartbeatCb = cb;
+}
+
+void IOTServerClient::onSyncResult(ResultCallback cb) {
+    syncCb = cb;
+}
+
+void IOTServerClient::onWriteResult(WriteResultCallback cb) {
+    writeResultCb = cb;
+}
+
+void IOTServerClient::setBackoff(unsigned long baseMs, unsigned long maxMs, uint8_t threshold) {
+    breaker.configure(baseMs, maxMs, threshold);
+}
+
+void IOTServerClient::setRequestTimeout(unsigned long ms) {
+    requestTimeout = ms;
+    applyRequestTimeout();
+}
+
+void IOTServerClient::applyRequestTimeout() {
+#if IOT_ENABLE_TLS && defined(ESP32)
+    // the handshake has its own timeout (seconds, 120 by default)
+    unsigned long s = (requestTimeout + 999) / 1000;
+    tlsClient.setHandshakeTimeout(s);
+    tlsAsyncClient.setHandshakeTimeout(s);
+#endif
+}
+
+void IOTServerClient::setDeltaSync(bool enabled) {
+    deltaSync = enabled;
+    if (!deltaSync) syncRevision = "";
+}
+
+void IOTServerClient::setTransport(ITransportAdapter* t) {
+    transport = t;
+    if (!transport) return;
+    if (transport->supportsPush() && !pushTransport) setPushTransport(transport);
+    else if (isConnected()) transport->connect();
+}
+
+void IOTServerClient::setPushTransport(ITransportAdapter* t) {
+    pushTransport = t;
+    if (!pushTransport) return;
+    pushTransport->onPush([this](const String& payload) { handlePush(payload); });
+    if (isConnected()) pushTransport->connect();
+    lastPushConnect = millis();
+}
+
+void IOTServerClient::pumpPushTransport() {
+    if (!pushTransport) return;
+    if (!pushTransport->connected()) {
+        // reconnect at most every 5 s
+        if (!isConnected() || millis() - lastPushConnect < 5000UL) return;
+        lastPushConnect = millis();
+        if (!pushTransport->connect()) return;
+    }
+    pushTransport->loop();
+}
+
+void IOTServerClient::handlePush(const String& payload) {
+    // a pushed message only moves syncRevision when it carries a revision of
+    // its own (applyVariables falls back to lastEtag otherwise)
+    lastEtag = syncRevision;
+    lastBinary = false; // pushed payloads are JSON
+    applyVariables(payload);
 }
 
 void IOTServerClient::loop() {
+    pumpPushTransport();
+    if (transport && transport != pushTransport) transport->loop();
+    pumpAsync();
     unsigned long now = millis();
-    if (now - lastHeartbeat >= heartbeatInterval) {
-        sendHeartbeat();
-        syncNow();
+    if (keepAlive && now - lastRequest >= keepAliveIdle && net->connected()) {
+        net->stop();
+    }
+    drainOffline();
+    if (storage && queueDirty && now - lastQueueSave >= 5000UL) saveOfflineQueue();
+    if (!logDirty.empty() && now - lastLogFlush >= logFlushMs) flushCacheLog();
+    bool windowDue = !deviceWrites.empty() || (!batching && !pending.empty());
+    if (batchWindow > 0 && windowDue && !holdWrites && now - batchStarted >= batchWindow) {
+        sendBatch();
+    }
+    if (!bulk.empty() && !bulkInFlight && !holdWrites && now - lastBulkAt >= bulkInterval) sendBulk();
+    if (adaptiveHeartbeat) {
+        // the pull is the heartbeat; pollMin also paces retries while unreachable
+        bool pushLive = pushTransport && pushTransport->connected();
+        bool pollDue = !pushLive && now - lastHeartbeat >= pollInterval;
+        bool quiet = now - lastContact >= heartbeatInterval;
+        if ((pollDue || quiet) && now - lastHeartbeat >= pollMin) {
+            if (devices.empty()) syncNow();
+            else gatewaySync();
+            lastHeartbeat = now;
+        }
+#if IOT_ENABLE_METRICS
+        // the pull has no body to carry stats; the gateway POST does
+        if (reportStats && devices.empty() && now - lastStatsAt >= heartbeatInterval) {
+            sendHeartbeat();
+            lastStatsAt = now;
+        }
+#endif
+    } else if (now - lastHeartbeat >= heartbeatInterval) {
+        if (devices.empty()) {
+            sendHeartbeat();
+            syncNow();
+        } else {
+            gatewaySync();
+        }
         lastHeartbeat = now;
     }
+    for (size_t i = 0; i < series.size(); i++) {
+        Series& s = series[i];
+        if (s.inFlight || s.buf.empty()) continue;
+        if (s.buf.size() >= IOT_SERIES_CHUNK || now - s.firstAt >= s.flushMs) uploadSeries(i);
+    }
+    // changes applied by pushes and async pulls
+    runDeferred();
 }
 
 String IOTServerClient::varTypeToString(VarType t) {
+    return varTypeName(t);
+}
+
+const char* IOTServerClient::varTypeName(VarType t) {
     switch (t) {
         case INT_TYPE: return "int";
         case FLOAT_TYPE: return "float";
@@ -38,218 +356,2269 @@ String IOTServerClient::varTypeToString(VarType t) {
     }
 }
 
-VarType IOTServerClient::stringToVarType(const String& s) {
-    if (s.equalsIgnoreCase("int")) return INT_TYPE;
-    if (s.equalsIgnoreCase("float")) return FLOAT_TYPE;
-    if (s.equalsIgnoreCase("bool") || s.equalsIgnoreCase("boolean")) return BOOLEAN_TYPE;
+VarType IOTServerClient::stringToVarType(const char* s) {
+    if (strcasecmp(s, "int") == 0) return INT_TYPE;
+    if (strcasecmp(s, "float") == 0) return FLOAT_TYPE;
+    if (strcasecmp(s, "bool") == 0 || strcasecmp(s, "boolean") == 0) return BOOLEAN_TYPE;
     return STRING_TYPE;
 }
 
-String IOTServerClient::makeRequest(const String& endpoint, const String& method, const String& payload, int retries) {
-    if (!isConnected()) return "";
+String IOTServerClient::makeRequest(const String& endpoint, const String& method, const String& payload, int retries,
+                                    int* status, const String& ifNoneMatch) {
+    String response;
+    performRequest(endpoint, method.c_str(), (const uint8_t*)payload.c_str(), payload.length(), retries,
+                   status, ifNoneMatch, &response);
+    return response;
+}
+
+size_t IOTServerClient::requestBuffered(const String& endpoint, const char* method, size_t len, int retries) {
+    rxBuf[0] = 0;
+    return performRequest(endpoint, method, (const uint8_t*)txBuf, len, retries, nullptr, "", nullptr);
+}
+
+size_t IOTServerClient::performRequest(const String& endpoint, const char* method, const uint8_t* body, size_t len,
+                                       int retries, int* status, const String& ifNoneMatch, String* out,
+                                       BodyParser parser) {
+#if IOT_ENABLE_METRICS
+    statAttempts = 0;
+    statReceived = 0;
+    int code = 0;
+    unsigned long start = millis();
+    size_t n = performAttempts(endpoint, method, body, len, retries, &code, ifNoneMatch, out, parser);
+    if (status) *status = code;
+    if (statAttempts > 0) recordRequest(endpoint, millis() - start, len, statReceived, statAttempts, n > 0 || code == 304);
+    return n;
+#else
+    return performAttempts(endpoint, method, body, len, retries, status, ifNoneMatch, out, parser);
+#endif
+}
+
+size_t IOTServerClient::performAttempts(const String& endpoint, const char* method, const uint8_t* body, size_t len,
+                                        int retries, int* status, const String& ifNoneMatch, String* out,
+                                        BodyParser parser) {
+    if (status) *status = 0;
+    lastEtag = "";
+    lastBinary = false;
+    if (!isConnected()) return 0;
+    if (!breaker.allow()) return 0; // server known to be down
+    if (transport) return transportRequest(endpoint, method, body, len, retries, status, ifNoneMatch, out, parser);
+
+    static const char* collect[] = { "ETag", "Content-Type", "Content-Encoding" };
+    // the body was encoded for the format in use before this request
+    const char* contentType = binaryWire() ? "application/msgpack" : "application/json";
+    // compress only for a server that has shown it speaks deflate
+    std::vector<uint8_t> packed;
+    bool deflated = compressionActive() && body && len >= IOT_COMPRESS_MIN && deflateZlib(body, len, packed);
 
     String url = serverUrl + endpoint;
     int attempts = 0;
+    // with reuse on, http.end() leaves the socket open and the next begin()
+    // to the same host skips the TCP handshake
+    http.setReuse(keepAlive);
     while (attempts <= retries) {
-        if (!http.begin(wifiClient, url)) {
+        bool reused = keepAlive && net->connected();
+        if (!http.begin(*net, url)) {
+            breaker.record(0); // settle a half-open probe
             attempts++;
-            delay(100);
+            if (attempts <= retries) delay(breaker.retryDelay(attempts));
             continue;
         }
 
+        noteAttempt();
+        http.setTimeout(requestTimeout);
         // headers
-        http.addHeader("Content-Type", "application/json");
+        http.addHeader("Content-Type", contentType);
         http.addHeader("X-DEVICE-KEY", deviceKey);
+        if (wireFormat == WIRE_MSGPACK) http.addHeader("Accept", "application/msgpack, application/json;q=0.5");
+        if (ifNoneMatch.length() > 0) http.addHeader("If-None-Match", ifNoneMatch);
+        if (compression && !inflateShort) http.addHeader("Accept-Encoding", "deflate");
+        if (deflated) http.addHeader("Content-Encoding", "deflate");
+        http.collectHeaders(collect, 3);
 
+        // HTTPClient takes a non-const pointer but only reads from it
+        uint8_t* data = deflated ? packed.data() : const_cast<uint8_t*>(body);
+        size_t size = deflated ? packed.size() : len;
         int httpCode = 0;
-        if (method == "GET") {
+        if (strcmp(method, "GET") == 0) {
             httpCode = http.GET();
-        } else if (method == "POST") {
-            httpCode = http.POST(payload);
-        } else if (method == "PUT") {
-            httpCode = http.PUT(payload);
+        } else if (strcmp(method, "POST") == 0) {
+            httpCode = http.POST(data, size);
+        } else if (strcmp(method, "PUT") == 0) {
+            httpCode = http.PUT(data, size);
         } else {
             // fallback
-            httpCode = http.sendRequest(method.c_str(), payload.c_str());
+            httpCode = http.sendRequest(method, data, size);
         }
 
-        String response = "";
+        if (status) *status = httpCode;
+        size_t n = 0;
         if (httpCode >= 200 && httpCode < 300) {
-            response = http.getString();
+            lastEtag = http.header("ETag");
+            String type = http.header("Content-Type");
+            if (type.length() > 0) {
+                // the server's choice of encoding settles what we send next
+                lastBinary = type.startsWith("application/msgpack");
+                msgpackAccepted = lastBinary;
+            }
+            bool inflate = http.header("Content-Encoding").equalsIgnoreCase("deflate");
+            if (inflate) deflateAccepted = true;
+            WiFiClient* stream = http.getStreamPtr();
+            if (parser && http.getSize() >= 0 && stream) {
+                // known length: parse straight off the socket
+                stream->setTimeout(requestTimeout);
+                parseWait = requestTimeout;
+                n = parseBody(*stream, parser, inflate) ? 1 : 0;
+                noteReceived(http.getSize());
+            } else if (parser) {
+                // chunked: HTTPClient has to de-chunk into a String first
+                String body = http.getString();
+                MemStream ms(body.c_str(), body.length());
+                ms.setTimeout(0);
+                parseWait = 0;
+                n = parseBody(ms, parser, inflate) ? 1 : 0;
+                noteReceived(body.length());
+            } else if (inflate) {
+                String raw = http.getString();
+                n = inflateBody(raw, out, rxBuf, sizeof(rxBuf));
+                noteReceived(raw.length());
+            } else if (out) {
+                *out = http.getString();
+                n = out->length();
+                noteReceived(n);
+            } else {
+                n = readBody(rxBuf, sizeof(rxBuf));
+                noteReceived(n);
+            }
+            noteHeap(); // body still in memory: the interesting low point
         }
         http.end();
+        lastRequest = millis();
+        if ((httpCode >= 200 && httpCode < 300) || httpCode == 304) lastContact = lastRequest;
 
-        if (response.length() > 0) return response;
+        if (n > 0 || httpCode == 304) {
+            breaker.record(httpCode);
+            return n;
+        }
+        if (httpCode == 415 && deflated) {
+            // the server reads deflate but won't take it in requests: resend as
+            // is, and keep sending plain bodies until setCompression() again
+            deflateRejected = true;
+            deflated = false;
+            continue;
+        }
+        if (httpCode < 0) {
+            // transport error: drop the socket so the next attempt reconnects
+            net->stop();
+            // the server may have closed an idle kept-alive socket; retry right away
+            if (reused) continue;
+        }
+        breaker.record(httpCode);
         attempts++;
-        // small backoff (non-blocking in real design; light blocking here)
-        delay(100 * attempts);
+        // stop early once the breaker has opened
+        if (attempts > retries || breaker.state() == CircuitBreaker::OPEN) break;
+        delay(breaker.retryDelay(attempts));
     }
-    return "";
+    return 0;
 }
 
-bool IOTServerClient::sendHeartbeat() {
-    StaticJsonDocument<128> doc;
+// same contract as performRequest, over the configured ITransportAdapter
+size_t IOTServerClient::transportRequest(const String& endpoint, const char* method, const uint8_t* body, size_t len,
+                                         int retries, int* status, const String& ifNoneMatch, String* out,
+                                         BodyParser parser) {
+    String headers;
+    if (ifNoneMatch.length() > 0) headers = "If-None-Match: " + ifNoneMatch + "\r\n";
+    String payload;
+    if (body) payload.concat((const char*)body, len);
+
+    for (int attempts = 0; attempts <= retries; ) {
+        ITransportAdapter::Response r;
+        noteAttempt();
+        transport->request(method, endpoint, payload, headers, r);
+        noteReceived(r.body.length());
+        lastRequest = millis();
+        if ((r.status >= 200 && r.status < 300) || r.status == 304) lastContact = lastRequest;
+        if (status) *status = r.status;
+        breaker.record(r.status);
+        if (r.status == 304) return 0;
+        if (r.status >= 200 && r.status < 300 && r.body.length() > 0) {
+            lastEtag = r.etag;
+            if (parser) {
+                MemStream ms(r.body.c_str(), r.body.length());
+                parseWait = 0;
+                return (this->*parser)(ms) ? 1 : 0;
+            }
+            if (out) {
+                *out = r.body;
+                return out->length();
+            }
+            size_t n = r.body.length() < sizeof(rxBuf) ? r.body.length() : sizeof(rxBuf) - 1;
+            memcpy(rxBuf, r.body.c_str(), n);
+            rxBuf[n] = 0;
+            return n;
+        }
+        attempts++;
+        if (attempts > retries || breaker.state() == CircuitBreaker::OPEN) break;
+        delay(breaker.retryDelay(attempts));
+    }
+    return 0;
+}
+
+size_t IOTServerClient::readBody(char* buf, size_t cap) {
+    int size = http.getSize();
+    WiFiClient* stream = http.getStreamPtr();
+    size_t n = 0;
+    if (size >= 0 && (size_t)size < cap && stream) {
+        n = stream->readBytes(buf, size);
+    } else {
+        // chunked or larger than the buffer: fall back to the heap, truncated
+        String s = http.getString();
+        n = s.length() < cap ? s.length() : cap - 1;
+        memcpy(buf, s.c_str(), n);
+    }
+    buf[n] = 0;
+    return n;
+}
+
+// deflate window, allocated on the first compressed answer; nullptr if short of memory
+uint8_t* IOTServerClient::inflateBuffer() {
+    if (!inflateWindow) inflateWindow.reset(new (std::nothrow) uint8_t[1u << IOT_INFLATE_WINDOW_BITS]);
+    return inflateWindow.get();
+}
+
+// runs parser over in, through the inflater when the answer is deflate-coded
+bool IOTServerClient::parseBody(Stream& in, BodyParser parser, bool inflate) {
+    if (!inflate) return (this->*parser)(in);
+    uint8_t* window = inflateBuffer();
+    if (!window) return false;
+    InflateStream z(in, window, IOT_INFLATE_WINDOW_BITS);
+    // the inflater already waits on `in` (its timeout); parsers must not wait again
+    unsigned long wait = parseWait;
+    parseWait = 0;
+    bool ok = (this->*parser)(z);
+    parseWait = wait;
+    // the parser stops at the closing bracket: read on to the checksum, which
+    // also leaves a kept-alive socket at the end of the body
+    while (z.read() >= 0) {}
+    if (z.tooLarge()) inflateShort = true;
+    return ok && z.finished();
+}
+
+// a deflate-coded body received whole: into *out when given, else into buf
+// (NUL-terminated, truncated to cap). returns the inflated length, 0 on error
+size_t IOTServerClient::inflateBody(const String& raw, String* out, char* buf, size_t cap) {
+    uint8_t* window = inflateBuffer();
+    if (!window) return 0;
+    MemStream ms(raw.c_str(), raw.length());
+    ms.setTimeout(0);
+    InflateStream z(ms, window, IOT_INFLATE_WINDOW_BITS);
+    size_t n = 0;
+    int c;
+    if (out) *out = "";
+    while ((c = z.read()) >= 0) {
+        if (out) *out += (char)c;
+        else if (n + 1 < cap) buf[n] = (char)c;
+        n++;
+    }
+    if (z.tooLarge()) inflateShort = true;
+    if (!out) buf[n < cap ? n : cap - 1] = 0;
+    if (!z.finished()) {
+        if (out) *out = "";
+        return 0;
+    }
+    return out || n < cap ? n : cap - 1;
+}
+
+// Async request queue
+bool IOTServerClient::enqueueRequest(const String& endpoint, const String& method, const String& payload, int retries,
+                                     RequestCallback done, const String& ifNoneMatch, bool critical,
+                                     int slot) {
+    if (asyncQueue.size() >= asyncQueueMax + (critical ? asyncCriticalReserve : 0)) return false;
+    AsyncRequest r;
+    r.endpoint = endpoint;
+    r.method = method;
+    r.payload = payload;
+    r.ifNoneMatch = ifNoneMatch;
+    r.retries = retries;
+    r.attempts = 0;
+    r.done = done;
+    r.critical = critical;
+    r.slot = slot;
+    if (!critical) {
+        asyncQueue.push_back(r);
+        return true;
+    }
+    // behind the request in flight (or waiting to retry) and earlier critical ones
+    size_t at = 0;
+    while (at < asyncQueue.size() && (asyncQueue[at].critical || asyncQueue[at].startedAt != 0)) at++;
+    asyncQueue.insert(asyncQueue.begin() + at, r);
+    return true;
+}
+
+// single-variable write in async mode. a write to the same variable that is
+// still waiting in the queue takes the new value instead of a second request
+bool IOTServerClient::enqueueWrite(int slot, const VarValue& value, bool critical) {
+    String payload = variablePayload(slot, value);
+    RequestCallback done = [this, slot, value](int, const String& res) {
+        bool ok = handleVariableResponse(res);
+        if (ok) confirmWrite(slot, value);
+        else if (offlineQueue.capacity() > 0) queueOffline(slot, value);
+        String name = cache.at(slot).name;
+        if (writeResultCb) writeResultCb(name, ok);
+    };
+    for (auto &r : asyncQueue) {
+        if (r.slot != slot || r.startedAt != 0 || r.critical != critical) continue;
+        r.payload = payload;
+        r.done = done;
+        return true;
+    }
+    return enqueueRequest("/api/device/variable", "POST", payload, 1, done, "", critical, slot);
+}
+
+void IOTServerClient::pumpAsync() {
+    if (asyncQueue.empty()) return;
+
+    if (!asyncActive) {
+        if ((long)(millis() - asyncRetryAt) < 0) return;
+        if (!isConnected() || !breaker.allow()) { completeAsync(0, ""); return; }
+        AsyncRequest& r = asyncQueue.front();
+        if (r.startedAt == 0) r.startedAt = millis() | 1;
+        if (transport) {
+            // adapters are synchronous; run the attempt right here
+            String headers;
+            if (r.ifNoneMatch.length() > 0) headers = "If-None-Match: " + r.ifNoneMatch + "\r\n";
+            ITransportAdapter::Response resp;
+            transport->request(r.method, r.endpoint, r.payload, headers, resp);
+            lastEtag = resp.etag;
+            breaker.record(resp.status);
+            if ((resp.status >= 200 && resp.status < 300 && resp.body.length() > 0) || resp.status == 304) {
+                completeAsync(resp.status, resp.body);
+            } else {
+                asyncAttemptFailed(resp.status);
+            }
+            return;
+        }
+        String headers = "Content-Type: application/json\r\nX-DEVICE-KEY: " + deviceKey + "\r\n";
+        if (r.ifNoneMatch.length() > 0) headers += "If-None-Match: " + r.ifNoneMatch + "\r\n";
+        asyncHttp.setTimeout(requestTimeout);
+        asyncHttp.start(host, port, r.method, basePath + r.endpoint, headers, r.payload);
+        asyncActive = true;
+    }
+
+    AsyncHttp::State st = asyncHttp.poll();
+    if (st == AsyncHttp::DONE) {
+        int code = asyncHttp.status();
+        lastEtag = asyncHttp.header("ETag");
+        breaker.record(code);
+        if ((code >= 200 && code < 300 && asyncHttp.body().length() > 0) || code == 304) {
+            completeAsync(code, asyncHttp.body());
+        } else {
+            asyncAttemptFailed(code);
+        }
+    } else if (st == AsyncHttp::FAILED) {
+        breaker.record(0);
+        asyncAttemptFailed(0);
+    }
+}
+
+void IOTServerClient::asyncAttemptFailed(int status) {
+    AsyncRequest& r = asyncQueue.front();
+    r.attempts++;
+    if (r.attempts <= r.retries && breaker.state() != CircuitBreaker::OPEN) {
+        // same backoff as the blocking path, but scheduled instead of delay()
+        asyncHttp.reset();
+        asyncActive = false;
+        asyncRetryAt = millis() + breaker.retryDelay(r.attempts);
+        return;
+    }
+    completeAsync(status, "");
+}
+
+void IOTServerClient::completeAsync(int status, const String& body) {
+    // pop first: the callback may queue further requests
+    RequestCallback done = asyncQueue.front().done;
+#if IOT_ENABLE_METRICS
+    const AsyncRequest& r = asyncQueue.front();
+    if (r.startedAt != 0) {
+        // startedAt has bit 0 forced on; do the same here or a request answered
+        // within the same millisecond would come out as ~49 days
+        recordRequest(r.endpoint, (millis() | 1) - r.startedAt, r.payload.length(), body.length(), r.attempts + 1,
+                      (status >= 200 && status < 300) || status == 304);
+        // the last attempt's send -> first byte, free of connect and polling delay
+        if (asyncHttp.firstByteAt() != 0) {
+            stats.endpoints[ClientStats::classify(r.endpoint)].server.add(asyncHttp.firstByteAt() -
+                                                                          asyncHttp.sentAt());
+        }
+    }
+#endif
+    asyncQueue.erase(asyncQueue.begin());
+    String res = body;
+    asyncHttp.reset();
+    asyncActive = false;
+    lastRequest = millis();
+    if ((status >= 200 && status < 300) || status == 304) lastContact = lastRequest;
+    lastBinary = false; // no Accept header on this path, so the answer is JSON
+    if (done) done(status, res);
+}
+
+size_t IOTServerClient::encodeHeartbeat(char* out, size_t cap) {
+    StaticJsonDocument<IOT_ENABLE_METRICS ? 256 : 128> doc;
     doc["status"] = "online";
     doc["ts"] = millis();
+#if IOT_ENABLE_METRICS
+    if (reportStats) addStats(doc.createNestedObject("stats"));
+#endif
+    return serializeBody(doc, out, cap);
+}
 
-    String payload;
-    serializeJson(doc, payload);
-    String res = makeRequest("/api/device/heartbeat", "POST", payload, 1);
-    if (res.length() == 0) return false;
+// JSON or MessagePack, whichever is negotiated. 0 if it doesn't fit in cap
+// (JSON also needs room for the terminating NUL)
+size_t IOTServerClient::serializeBody(JsonDocument& doc, char* out, size_t cap) {
+    if (binaryWire()) return measureMsgPack(doc) <= cap ? serializeMsgPack(doc, out, cap) : 0;
+    size_t n = serializeJson(doc, out, cap);
+    // a truncated payload would be invalid JSON
+    return n < cap - 1 ? n : 0;
+}
+
+DeserializationError IOTServerClient::decodeResponse(JsonDocument& doc, const char* res, size_t len) {
+    doc.clear();
+    if (lastBinary) return deserializeMsgPack(doc, res, len);
+    return deserializeJson(doc, res, len);
+}
+
+void IOTServerClient::setWireFormat(WireFormat f) {
+    localWireFormat = f;
+    wireFormat = f;
+    msgpackAccepted = false;
+#if IOT_MAX_VARIABLES > 0
+    if (f == WIRE_MSGPACK) wireSlots.reserve(IOT_MAX_WIRE_ID);
+#endif
+}
+
+void IOTServerClient::setCompression(bool enabled) {
+    compression = enabled;
+    deflateAccepted = false;
+    deflateRejected = false;
+    inflateShort = false;
+}
+
+bool IOTServerClient::binaryWire() const {
+    return wireFormat == WIRE_MSGPACK && msgpackAccepted && !asyncMode && !transport;
+}
+
+bool IOTServerClient::sendHeartbeat() {
+    size_t len = encodeHeartbeat(txBuf, sizeof(txBuf));
+    if (len == 0) {
+        // didn't fit IOT_TX_BUFFER_SIZE (stats included): txBuf holds no payload
+        if (heartbeatCb) heartbeatCb(false);
+        return false;
+    }
+    if (asyncMode) {
+        return enqueueRequest("/api/device/heartbeat", "POST", txBuf, 1, [this](int, const String& res) {
+            bool ok = handleHeartbeatResponse(res);
+            if (heartbeatCb) heartbeatCb(ok);
+        });
+    }
+    size_t n = requestBuffered("/api/device/heartbeat", "POST", len, 1);
+    return handleHeartbeatResponse(rxBuf, n);
+}
+
+bool IOTServerClient::handleHeartbeatResponse(const char* res, size_t len) {
+    if (len == 0) return false;
 
     // optional: parse response for success
-    DynamicJsonDocument rd(256);
-    if (deserializeJson(rd, res)) return false;
-    if (rd.containsKey("success")) return rd["success"] | false;
+    if (decodeResponse(responseDoc, res, len)) return false;
+    if (responseDoc.containsKey("poll")) applyPollHint(responseDoc["poll"] | 0UL);
+    if (responseDoc.containsKey("config")) applyConfig(responseDoc["config"].as<JsonObjectConst>());
+    if (responseDoc.containsKey("success")) return responseDoc["success"] | false;
     return true;
 }
 
-bool IOTServerClient::sendVariable(const String& name, const String& value, VarType type) {
-    StaticJsonDocument<256> doc;
-    doc["name"] = name;
-    doc["value"] = value;
-    doc["type"] = varTypeToString(type);
+size_t IOTServerClient::encodeVariable(int slot, const VarValue& value, char* out, size_t cap) {
+    // numbers are formatted on the stack; names and string values are
+    // referenced, not copied, so the document stays small
+    StaticJsonDocument<128> doc;
+    if (binaryWire()) {
+        packEntry(doc.to<JsonObject>(), slot, value);
+        return serializeBody(doc, out, cap);
+    }
+    char num[24];
+    doc["name"] = cache.at(slot).name.c_str();
+    switch (value.type) {
+        case INT_TYPE: snprintf(num, sizeof(num), "%ld", (long)value.i); doc["value"] = (const char*)num; break;
+        case FLOAT_TYPE: dtostrf(value.f, 1, 6, num); doc["value"] = (const char*)num; break;
+        case BOOLEAN_TYPE: doc["value"] = value.b ? "true" : "false"; break;
+        default: doc["value"] = value.s.c_str(); break;
+    }
+    doc["type"] = varTypeName(value.type);
+    return serializeBody(doc, out, cap);
+}
+
+// compact MessagePack entry: { i, v } once the server has assigned an id,
+// { n, t, v } before that. values keep their native type (a float is 5 bytes)
+void IOTServerClient::packEntry(JsonObject o, int slot, const VarValue& value) {
+    const Variable& v = cache.at(slot);
+    if (v.wireId != 0) {
+        o["i"] = v.wireId;
+    } else {
+        o["n"] = v.name.c_str();
+        o["t"] = (int)value.type;
+    }
+    switch (value.type) {
+        case INT_TYPE: o["v"] = value.i; break;
+        case FLOAT_TYPE: o["v"] = value.f; break;
+        case BOOLEAN_TYPE: o["v"] = value.b; break;
+        default: o["v"] = value.s.c_str(); break;
+    }
+}
 
+void IOTServerClient::learnId(int slot, unsigned id) {
+    // ids are per device key; sub-devices always go by name
+    if (id == 0 || id >= IOT_MAX_WIRE_ID || cache.at(slot).device != 0) return;
+    cache.at(slot).wireId = id;
+    if (wireSlots.size() <= id) wireSlots.resize(id + 1, 0);
+    wireSlots[id] = slot + 1;
+}
+
+String IOTServerClient::variablePayload(int slot, const VarValue& value) {
+    size_t n = encodeVariable(slot, value, txBuf, sizeof(txBuf));
+    if (n > 0) return String(txBuf);
+
+    // too large for txBuf (long string value)
+    const String& name = cache.at(slot).name;
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(3) + name.length() + value.s.length() + 32);
+    doc["name"] = name;
+    doc["value"] = value.toString();
+    doc["type"] = varTypeName(value.type);
     String payload;
     serializeJson(doc, payload);
+    return payload;
+}
 
-    String res = makeRequest("/api/device/variable", "POST", payload, 1);
-    if (res.length() == 0) return false;
+bool IOTServerClient::sendVariable(int slot, const VarValue& value) {
+    size_t len = encodeVariable(slot, value, txBuf, sizeof(txBuf));
+    size_t n = 0;
+    if (len > 0) {
+        n = requestBuffered("/api/device/variable", "POST", len, 1);
+    } else {
+        // too large for txBuf (long string value); room for every char escaped
+        std::vector<char> buf(cache.at(slot).name.length() + value.s.length() * 6 + 64);
+        len = encodeVariable(slot, value, buf.data(), buf.size());
+        rxBuf[0] = 0;
+        if (len > 0) n = performRequest("/api/device/variable", "POST", (const uint8_t*)buf.data(), len, 1,
+                                        nullptr, "", nullptr);
+    }
+    bool ok = handleVariableResponse(rxBuf, n);
+    // the answer to a first write may carry the variable's id
+    if (ok && n > 0) learnId(slot, responseDoc["id"] | 0U);
+    return ok;
+}
+
+bool IOTServerClient::handleVariableResponse(const char* res, size_t len) {
+    if (len == 0) return false;
 
     // parse success optionally
-    DynamicJsonDocument rd(256);
-    if (!deserializeJson(rd, res)) return true; // if response not parseable, assume success
-    if (rd.containsKey("success")) return rd["success"] | true;
+    if (decodeResponse(responseDoc, res, len)) return true; // if response not parseable, assume success
+    if (responseDoc.containsKey("success")) return responseDoc["success"] | true;
     return true;
 }
 
 bool IOTServerClient::virtualWrite(const String& name, int value) {
-    String val = String(value);
-    bool ok = sendVariable(name, val, INT_TYPE);
-    if (ok) updateCache(name, val, INT_TYPE);
-    return ok;
+    return writeVariable(name, VarValue::ofInt(value));
 }
 
 bool IOTServerClient::virtualWrite(const String& name, float value) {
-    String val = String(value, 6);
-    bool ok = sendVariable(name, val, FLOAT_TYPE);
-    if (ok) updateCache(name, val, FLOAT_TYPE);
-    return ok;
+    return writeVariable(name, VarValue::ofFloat(value));
 }
 
 bool IOTServerClient::virtualWrite(const String& name, bool value) {
-    String val = value ? "true" : "false";
-    bool ok = sendVariable(name, val, BOOLEAN_TYPE);
-    if (ok) updateCache(name, val, BOOLEAN_TYPE);
-    return ok;
+    return writeVariable(name, VarValue::ofBool(value));
 }
 
 bool IOTServerClient::virtualWrite(const String& name, const String& value) {
-    bool ok = sendVariable(name, value, STRING_TYPE);
-    if (ok) updateCache(name, value, STRING_TYPE);
+    return writeVariable(name, VarValue::ofString(value));
+}
+
+bool IOTServerClient::writeVariable(const String& name, const VarValue& value, uint8_t device) {
+    int slot = cache.insert(name, value.type, device);
+    if (slot == VariableCache::npos) return false;
+    return writeSlot(slot, value);
+}
+
+bool IOTServerClient::writeSlot(int slot, const VarValue& value) {
+    if (!shouldSend(cache.at(slot), value)) return true;
+    uint8_t priority = cache.at(slot).priority;
+    // sub-device writes go out with the next gateway sync; a critical one
+    // doesn't wait for it, and goes out alone
+    if (holdWrites || cache.at(slot).device != 0) {
+        if (!holdWrites && priority == PRIORITY_CRITICAL && sendDeviceWrite(slot, value)) return true;
+        queueWrite(slot, value);
+        return true;
+    }
+
+    // once something is queued offline, newer writes queue behind it so the
+    // server sees them in order. a critical one skips the backlog whenever it
+    // can be sent, and only waits while offline
+    bool critical = priority == PRIORITY_CRITICAL;
+    if (offlineQueue.capacity() > 0 && (!offlineQueue.empty() || !isConnected())) {
+        if (!critical || !isConnected()) {
+            queueOffline(slot, value);
+            if (critical) nextDrainAt = millis(); // the replay doesn't wait out the backoff
+            return true;
+        }
+        supersedeOffline(slot, value);
+    }
+
+    if (priority == PRIORITY_BULK) {
+        queueBulk(slot, value);
+        return true;
+    }
+    if (!critical && (batching || batchWindow > 0)) {
+        queueWrite(slot, value);
+        return true;
+    }
+    if (asyncMode) return enqueueWrite(slot, value, critical);
+    bool ok = sendVariable(slot, value);
+    if (ok) confirmWrite(slot, value);
+    else if (offlineQueue.capacity() > 0) { queueOffline(slot, value); return true; }
     return ok;
 }
 
-Variable* IOTServerClient::findInCache(const String& name) {
-    for (auto &v : cache) {
-        if (v.name == name) return &v;
+void IOTServerClient::confirmWrite(int slot, const VarValue& value) {
+    cache.at(slot).lastPushAt = millis();
+    updateSlot(slot, value, false);
+}
+
+// Offline queue
+void IOTServerClient::setOfflineQueue(size_t capacity) {
+    offlineQueue.reset(capacity);
+    drainInFlight = false;
+    drainOverwritten = 0;
+}
+
+void IOTServerClient::setStorage(IStorageAdapter* s) {
+    storage = s;
+    if (storage) storage->begin();
+}
+
+void IOTServerClient::queueOffline(int slot, const VarValue& value) {
+    PendingWrite pw;
+    pw.slot = slot;
+    pw.value = value;
+    pw.offline = true;
+    pw.at = millis();
+    if (!offlineQueue.push(pw) && drainInFlight) drainOverwritten++;
+    // keep local state current even though the server hasn't seen it yet
+    updateSlot(slot, value, false);
+    queueDirty = true;
+}
+
+// queued offline writes of slot take the newer value, so replaying them after a
+// write that went out directly can't undo it
+void IOTServerClient::supersedeOffline(int slot, const VarValue& value) {
+    unsigned long now = millis();
+    for (size_t i = 0; i < offlineQueue.size(); i++) {
+        PendingWrite& p = offlineQueue.at(i);
+        if (p.slot != slot) continue;
+        p.value = value;
+        p.at = now;
+        queueDirty = true;
     }
-    return nullptr;
 }
 
-void IOTServerClient::updateCache(const String& name, const String& value, VarType type) {
-    Variable* v = findInCache(name);
-    if (v) {
-        v->value = value;
-        v->type = type;
-    } else {
-        Variable nv;
-        nv.name = name;
-        nv.type = type;
-        nv.value = value;
-        cache.push_back(nv);
-    }
-    // call any registered callbacks for this name/type
-    processUpdate(name, value, type);
-}
-
-void IOTServerClient::processUpdate(const String& name, const String& value, VarType type) {
-    for (auto &cb : callbacks) {
-        if (cb.name == name) {
-            // match type and call if exists
-            if (type == INT_TYPE && cb.intCb) {
-                cb.intCb(value.toInt());
-            } else if (type == FLOAT_TYPE && cb.floatCb) {
-                cb.floatCb(value.toFloat());
-            } else if (type == BOOLEAN_TYPE && cb.boolCb) {
-                String vv = value;
-                bool b = (vv.equalsIgnoreCase("true") || vv == "1");
-                cb.boolCb(b);
-            } else if (type == STRING_TYPE && cb.stringCb) {
-                cb.stringCb(value);
-            }
-        }
+void IOTServerClient::drainOffline() {
+    if (offlineQueue.empty() || drainInFlight || !isConnected()) return;
+    if ((long)(millis() - nextDrainAt) < 0) return;
+
+    size_t n = offlineQueue.size();
+    if (n > drainBatch) n = drainBatch;
+    std::vector<PendingWrite> batch;
+    batch.reserve(n);
+    for (size_t i = 0; i < n; i++) batch.push_back(offlineQueue.at(i));
+
+    if (asyncMode) {
+        drainInFlight = enqueueRequest("/api/device/variables/batch", "POST", batchPayload(batch), 0,
+            [this, n](int, const String& res) {
+                drainDone(n, handleVariableResponse(res));
+            });
+        return;
     }
+    drainDone(n, postBatch(batch, 0));
 }
 
-bool IOTServerClient::syncNow() {
-    String res = makeRequest("/api/device/variables", "GET", "", 1);
-    if (res.length() == 0) return false;
+void IOTServerClient::drainDone(size_t n, bool ok) {
+    drainInFlight = false;
+    size_t overwritten = drainOverwritten;
+    drainOverwritten = 0;
+    if (!ok) {
+        // back off (1 s doubling to 60 s, plus jitter) so a recovering server
+        // isn't hit by every device at once
+        drainBackoff = drainBackoff == 0 ? 1000UL : drainBackoff * 2;
+        if (drainBackoff > 60000UL) drainBackoff = 60000UL;
+        nextDrainAt = millis() + drainBackoff + random(drainBackoff / 2);
+        return;
+    }
+    drainBackoff = 0;
+    n = n > overwritten ? n - overwritten : 0;
+    unsigned long now = millis();
+    for (size_t i = 0; i < n; i++) cache.at(offlineQueue.at(i).slot).lastPushAt = now;
+    offlineQueue.pop(n);
+    queueDirty = true;
+}
 
-    // parse { variables: [ { name, type, value }, ... ] }
-    DynamicJsonDocument d(4096);
-    DeserializationError err = deserializeJson(d, res);
-    if (err) return false;
+void IOTServerClient::saveOfflineQueue() {
+    queueDirty = false;
+    lastQueueSave = millis();
+    if (!storage) return;
+    if (offlineQueue.empty()) { storage->remove("iot_outq"); return; }
 
-    if (!d.containsKey("variables")) return false;
-    JsonArray arr = d["variables"].as<JsonArray>();
-    for (JsonObject obj : arr) {
-        String name = obj["name"].as<String>();
-        String typeS = obj["type"].as<String>();
-        String val = obj["value"].as<String>();
-        VarType vt = stringToVarType(typeS);
-        updateCache(name, val, vt);
+    size_t cap = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(offlineQueue.size());
+    for (size_t i = 0; i < offlineQueue.size(); i++) {
+        const PendingWrite& p = offlineQueue.at(i);
+        cap += JSON_OBJECT_SIZE(4) + cache.at(p.slot).name.length() + p.value.s.length() + 32;
     }
-    return true;
+    DynamicJsonDocument doc(cap);
+    JsonArray arr = doc.createNestedArray("q");
+    unsigned long now = millis();
+    for (size_t i = 0; i < offlineQueue.size(); i++) {
+        const PendingWrite& p = offlineQueue.at(i);
+        JsonObject o = arr.createNestedObject();
+        o["n"] = cache.at(p.slot).name;
+        o["t"] = (int)p.value.type;
+        o["v"] = p.value.toString();
+        o["a"] = now - p.at;
+    }
+    String out;
+    serializeJson(doc, out);
+    storage->saveString("iot_outq", out);
 }
 
-// Read methods
-int IOTServerClient::virtualReadInt(const String& name) {
-    Variable* v = findInCache(name);
-    if (!v) return 0;
-    return v->value.toInt();
+void IOTServerClient::loadOfflineQueue() {
+    if (!storage || offlineQueue.capacity() == 0 || !storage->exists("iot_outq")) return;
+    String in = storage->readString("iot_outq");
+    if (in.length() == 0) return;
+
+    DynamicJsonDocument doc(in.length() * 2 + 256);
+    if (deserializeJson(doc, in)) return;
+    unsigned long now = millis();
+    for (JsonObject o : doc["q"].as<JsonArray>()) {
+        VarType t = (VarType)(o["t"] | (int)STRING_TYPE);
+        int slot = cache.insert(o["n"].as<String>(), t);
+        if (slot == VariableCache::npos) continue;
+        PendingWrite pw;
+        pw.slot = slot;
+        pw.value = VarValue::parse(o["v"].as<String>(), t);
+        pw.offline = true;
+        // time spent powered off is unknown; the age counts from the save
+        pw.at = now - (unsigned long)(o["a"] | 0UL);
+        offlineQueue.push(pw);
+        // restore local state without firing callbacks
+        Variable& v = cache.at(slot);
+        v.value = pw.value;
+        v.known = true;
+    }
 }
-float IOTServerClient::virtualReadFloat(const String& name) {
-    Variable* v = findInCache(name);
-    if (!v) return 0.0f;
-    return v->value.toFloat();
+
+// Metrics
+#if IOT_ENABLE_METRICS
+void IOTServerClient::noteHeap() {
+#if defined(ESP32)
+    uint32_t heap = ESP.getMinFreeHeap(); // the core keeps its own low-water mark
+#else
+    uint32_t heap = ESP.getFreeHeap();
+#endif
+    if (heap < stats.minFreeHeap) stats.minFreeHeap = heap;
 }
-bool IOTServerClient::virtualReadBool(const String& name) {
-    Variable* v = findInCache(name);
-    if (!v) return false;
-    String vv = v->value;
-    return (vv.equalsIgnoreCase("true") || vv == "1");
+
+void IOTServerClient::recordRequest(const String& endpoint, unsigned long ms, size_t sent, size_t received,
+                                    int attempts, bool ok) {
+    EndpointStats& e = stats.endpoints[ClientStats::classify(endpoint)];
+    e.requests++;
+    if (!ok) e.failures++;
+    if (attempts > 1) e.retries += attempts - 1;
+    e.bytesSent += sent;
+    e.bytesReceived += received;
+    e.latency.add(ms);
+    noteHeap();
 }
-String IOTServerClient::virtualReadString(const String& name) {
-    Variable* v = findInCache(name);
-    if (!v) return String("");
-    return v->value;
+
+void IOTServerClient::addStats(JsonObject o) {
+    EndpointStats t = stats.total();
+    o["req"] = t.requests;
+    o["fail"] = t.failures;
+    o["retry"] = t.retries;
+    o["tx"] = t.bytesSent;
+    o["rx"] = t.bytesReceived;
+    o["p50"] = t.p50();
+    o["p99"] = t.p99();
+    o["heap"] = stats.minFreeHeap;
 }
+#endif
 
-// Callback registration
-void IOTServerClient::onWriteInt(const String& name, IntCallback cb) {
-    for (auto &e : callbacks) if (e.name == name) { e.intCb = cb; return; }
-    CallbackEntry e; e.name = name; e.type = INT_TYPE; e.intCb = cb; callbacks.push_back(e);
+// Cache persistence: lines of { n, t, v, d? }, each file starting with
+// { g: generation, c: entries written by the compaction that created it }.
+// the two keys take turns, so a compaction cut short by a reset leaves the
+// previous file to restore from
+static const char* const cacheLogKeys[2] = { "iot_log0", "iot_log1" };
+
+void IOTServerClient::setCachePersistence(bool enabled, unsigned long flushMs, size_t compactBytes) {
+    cacheLog = enabled;
+    logFlushMs = flushMs;
+    logCompactBytes = compactBytes;
 }
-void IOTServerClient::onWriteFloat(const String& name, FloatCallback cb) {
-    for (auto &e : callbacks) if (e.name == name) { e.floatCb = cb; return; }
-    CallbackEntry e; e.name = name; e.type = FLOAT_TYPE; e.floatCb = cb; callbacks.push_back(e);
+
+void IOTServerClient::loadCacheLog() {
+    if (!cacheLog || !storage) return;
+    String text[2];
+    for (int k = 0; k < 2; k++) {
+        if (storage->exists(cacheLogKeys[k])) text[k] = storage->readString(cacheLogKeys[k]);
+    }
+    int pick = text[0].length() > 0 ? 0 : 1;
+    if (text[0].length() > 0 && text[1].length() > 0) {
+        // both left over: the newer one counts unless it is missing entries
+        long gen[2];
+        size_t expect[2], found[2];
+        for (int k = 0; k < 2; k++) found[k] = readCacheLog(text[k], false, &gen[k], &expect[k]);
+        pick = gen[1] > gen[0] ? 1 : 0;
+        if (found[pick] < expect[pick]) pick = 1 - pick;
+        storage->remove(cacheLogKeys[1 - pick]);
+    }
+
+    size_t expect = 0;
+    if (text[pick].length() > 0 && readCacheLog(text[pick], true, &logGen, &expect) == 0 && logGen < 0) {
+        storage->remove(cacheLogKeys[pick]); // no header: not ours
+    }
+    logBytes = logGen < 0 ? 0 : text[pick].length();
+    logLive = logBytes;
+    logReady = true;
+    lastLogFlush = millis();
+    // appends after a torn line would be glued to it; start a clean file
+    if (logGen >= 0 && !text[pick].endsWith("\n")) compactCacheLog();
+    for (size_t i = 0; i < cache.size(); i++) {
+        if (cache.at(i).known && cache.at(i).callback != 0) dispatch(i);
+    }
 }
-void IOTServerClient::onWriteBool(const String& name, BoolCallback cb) {
-    for (auto &e : callbacks) if (e.name == name) { e.boolCb = cb; return; }
-    CallbackEntry e; e.name = name; e.type = BOOLEAN_TYPE; e.boolCb = cb; callbacks.push_back(e);
+
+// entry lines in text; with apply they are restored into the cache, later
+// lines overriding earlier ones, without firing callbacks. a torn last line
+// (reset during an append) is ignored
+size_t IOTServerClient::readCacheLog(const String& text, bool apply, long* gen, size_t* expect) {
+    StaticJsonDocument<IOT_SYNC_ENTRY_DOC_SIZE> doc;
+    *gen = -1;
+    *expect = 0;
+    size_t n = 0;
+    int at = 0;
+    while (at < (int)text.length()) {
+        int end = text.indexOf('\n', at);
+        if (end < 0) break;
+        bool first = at == 0;
+        DeserializationError err = deserializeJson(doc, text.c_str() + at, end - at);
+        at = end + 1;
+        if (err == DeserializationError::NoMemory && apply) entriesSkipped++;
+        if (err) continue;
+        if (first && doc.containsKey("g")) {
+            *gen = doc["g"] | 0L;
+            *expect = doc["c"] | 0U;
+            continue;
+        }
+        if (!doc.containsKey("n")) continue;
+        n++;
+        if (!apply) continue;
+        VarType t = (VarType)(doc["t"] | (int)STRING_TYPE);
+        int slot = cache.insert(doc["n"] | "", t, doc["d"] | 0);
+        if (slot == VariableCache::npos) continue;
+        scratch.set(doc["v"] | "", t);
+        updateSlot(slot, scratch, false);
+    }
+    return n;
 }
-void IOTServerClient::onWriteString(const String& name, StringCallback cb) {
-    for (auto &e : callbacks) if (e.name == name) { e.stringCb = cb; return; }
-    CallbackEntry e; e.name = name; e.type = STRING_TYPE; e.stringCb = cb; callbacks.push_back(e);
+
+void IOTServerClient::appendLogLine(String& out, const Variable& v) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(4) + 32> doc;
+    doc["n"] = v.name.c_str();
+    doc["t"] = (int)v.value.type;
+    if (v.value.type == STRING_TYPE) doc["v"] = v.value.s.c_str();
+    else doc["v"] = v.value.toString();
+    if (v.device != 0) doc["d"] = v.device;
+    String line;
+    serializeJson(doc, line);
+    out += line;
+    out += '\n';
+}
+
+// one append for everything changed since the last flush
+bool IOTServerClient::flushCacheLog() {
+    lastLogFlush = millis();
+    if (!storage || !logReady || logDirty.empty()) return true;
+    if (logGen < 0) return compactCacheLog(); // first file: starts as a snapshot
+
+    String lines;
+    for (uint16_t slot : logDirty) appendLogLine(lines, cache.at(slot));
+    // on failure the changes stay queued for the next flush
+    if (!storage->appendString(cacheLogKeys[logGen & 1], lines)) return false;
+    for (uint16_t slot : logDirty) cache.at(slot).logQueued = false;
+    logDirty.clear();
+    logBytes += lines.length();
+    // rewrite once the log has grown well past what it describes
+    if (logBytes > logCompactBytes && logBytes > 2 * logLive) return compactCacheLog();
+    return true;
+}
+
+// every known variable into the other key, then drop the old file
+bool IOTServerClient::compactCacheLog() {
+    long next = logGen + 1;
+    String lines;
+    size_t count = 0;
+    for (auto &v : cache) {
+        if (!v.known) continue;
+        appendLogLine(lines, v);
+        count++;
+    }
+    String text = "{\"g\":" + String(next) + ",\"c\":" + String((unsigned long)count) + "}\n";
+    text += lines;
+    if (!storage->saveString(cacheLogKeys[next & 1], text)) return false;
+    if (logGen >= 0) storage->remove(cacheLogKeys[logGen & 1]);
+    logGen = next;
+    logBytes = logLive = text.length();
+    for (uint16_t slot : logDirty) cache.at(slot).logQueued = false;
+    logDirty.clear();
+    return true;
+}
+
+// Sleep cycle
+void IOTServerClient::setSleepCycle(bool enabled) {
+    sleepCycle = enabled;
+}
+
+// Snapshot layout, binary so that an RTC area holds a useful number of entries:
+//   'S' version flags(bit 0: msgpack negotiated) [revision length][revision]
+//   [count: u16] variables, then [count: u16] held writes, each entry
+//   [tag][name length][name][id: u16]?[device]?[value]?
+// tag: type in bits 0-1, then SNAP_VALUE / SNAP_ID / SNAP_DEVICE. values are
+// raw: int and float 4 bytes, bool 1, a string u16 length + bytes. d refers to
+// addDevice() order, so add sub-devices before begin()
+namespace {
+
+const uint8_t snapVersion = 1;
+enum { SNAP_VALUE = 4, SNAP_ID = 8, SNAP_DEVICE = 16 };
+
+void putSnap(String& out, const void* p, size_t n) {
+    out.concat((const char*)p, n);
+}
+
+// false if the name or string value is too long for its length field
+bool putSnapEntry(String& out, const Variable& v, const VarValue* value, bool withId) {
+    if (v.name.length() > 255 || (value && value->type == STRING_TYPE && value->s.length() > 0xffff)) return false;
+    uint8_t tag = (uint8_t)(value ? value->type : v.value.type);
+    if (value) tag |= SNAP_VALUE;
+    if (withId && v.wireId != 0) tag |= SNAP_ID;
+    if (v.device != 0) tag |= SNAP_DEVICE;
+    uint8_t len = v.name.length();
+    putSnap(out, &tag, 1);
+    putSnap(out, &len, 1);
+    putSnap(out, v.name.c_str(), len);
+    if (tag & SNAP_ID) putSnap(out, &v.wireId, 2);
+    if (tag & SNAP_DEVICE) putSnap(out, &v.device, 1);
+    if (!value) return true;
+    switch (value->type) {
+        case INT_TYPE: putSnap(out, &value->i, 4); break;
+        case FLOAT_TYPE: putSnap(out, &value->f, 4); break;
+        case BOOLEAN_TYPE: { uint8_t b = value->b; putSnap(out, &b, 1); break; }
+        default: {
+            uint16_t n = value->s.length();
+            putSnap(out, &n, 2);
+            putSnap(out, value->s.c_str(), n);
+            break;
+        }
+    }
+    return true;
+}
+
+struct SnapReader {
+    const uint8_t* p;
+    size_t left;
+
+    bool get(void* out, size_t n) {
+        if (n > left) return false;
+        memcpy(out, p, n);
+        p += n;
+        left -= n;
+        return true;
+    }
+    bool getString(String& out, size_t n) {
+        if (n > left) return false;
+        out = "";
+        out.concat((const char*)p, n);
+        p += n;
+        left -= n;
+        return true;
+    }
+};
+
+struct SnapEntry {
+    uint8_t tag = 0;
+    String name;
+    uint16_t id = 0;
+    uint8_t device = 0;
+    VarValue value;
+};
+
+bool getSnapEntry(SnapReader& r, SnapEntry& e) {
+    uint8_t len = 0;
+    e.id = 0;
+    e.device = 0;
+    if (!r.get(&e.tag, 1) || !r.get(&len, 1) || !r.getString(e.name, len)) return false;
+    if ((e.tag & SNAP_ID) && !r.get(&e.id, 2)) return false;
+    if ((e.tag & SNAP_DEVICE) && !r.get(&e.device, 1)) return false;
+    e.value.type = (VarType)(e.tag & 3);
+    if (!(e.tag & SNAP_VALUE)) return true;
+    switch (e.value.type) {
+        case INT_TYPE: return r.get(&e.value.i, 4);
+        case FLOAT_TYPE: return r.get(&e.value.f, 4);
+        case BOOLEAN_TYPE: { uint8_t b = 0; if (!r.get(&b, 1)) return false; e.value.b = b != 0; return true; }
+        default: { uint16_t n = 0; return r.get(&n, 2) && r.getString(e.value.s, n); }
+    }
+}
+
+}
+
+bool IOTServerClient::prepareSleep() {
+    if (queueDirty) saveOfflineQueue();
+    flushCacheLog();
+    // unsent bulk writes are kept with the held ones (which are newer)
+    for (auto &b : bulk) {
+        bool held = false;
+        for (auto &p : pending) if (p.slot == b.slot) { held = true; break; }
+        if (!held) queueWrite(b.slot, b.value);
+    }
+    bulk.clear();
+    http.end();
+    net->stop();
+    snapBytes = 0;
+    if (!storage || syncRevision.length() > 255) return false;
+
+    String out;
+    uint8_t head[4] = { 'S', snapVersion, (uint8_t)(msgpackAccepted ? 1 : 0), (uint8_t)syncRevision.length() };
+    putSnap(out, head, sizeof(head));
+    putSnap(out, syncRevision.c_str(), syncRevision.length());
+    uint16_t count = 0;
+    for (auto &v : cache) if (v.known || v.wireId != 0) count++;
+    putSnap(out, &count, 2);
+    for (auto &v : cache) {
+        if (!v.known && v.wireId == 0) continue;
+        if (!putSnapEntry(out, v, v.known ? &v.value : nullptr, true)) return false;
+    }
+    count = pending.size() + deviceWrites.size();
+    putSnap(out, &count, 2);
+    for (auto* queue : { &pending, &deviceWrites }) {
+        for (auto &p : *queue) {
+            if (!putSnapEntry(out, cache.at(p.slot), &p.value, false)) return false;
+        }
+    }
+    snapBytes = out.length();
+    return storage->saveString("iot_snap", out);
+}
+
+void IOTServerClient::loadSnapshot() {
+    if (!storage || !storage->exists("iot_snap")) return;
+    String in = storage->readString("iot_snap");
+    SnapReader r = { (const uint8_t*)in.c_str(), in.length() };
+    uint8_t head[4];
+    // anything else (an older JSON snapshot) is ignored; the first pull refills the cache
+    if (!r.get(head, sizeof(head)) || head[0] != 'S' || head[1] != snapVersion) return;
+    if (!r.getString(syncRevision, head[3])) return;
+    msgpackAccepted = head[2] & 1;
+
+    SnapEntry e;
+    uint16_t count = 0;
+    if (!r.get(&count, 2)) return;
+    for (uint16_t n = 0; n < count; n++) {
+        if (!getSnapEntry(r, e)) return;
+        int slot = cache.insert(e.name, e.value.type, e.device);
+        if (slot == VariableCache::npos) continue;
+        learnId(slot, e.id);
+        if (!(e.tag & SNAP_VALUE)) continue;
+        // restore local state without firing callbacks
+        Variable& v = cache.at(slot);
+        v.value = e.value;
+        v.known = true;
+    }
+    if (!r.get(&count, 2)) return;
+    for (uint16_t n = 0; n < count; n++) {
+        if (!getSnapEntry(r, e)) return;
+        int slot = cache.insert(e.name, e.value.type, e.device);
+        if (slot != VariableCache::npos) queueWrite(slot, e.value);
+    }
+}
+
+// heartbeat, held writes and the delta pull in one POST; the answer is a
+// variable list as for GET /api/device/variables
+bool IOTServerClient::wakeSync() {
+    bool binary = binaryWire();
+    DynamicJsonDocument doc(batchDocSize(pending) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(8));
+    doc["status"] = "online";
+    doc["ts"] = millis();
+#if IOT_ENABLE_METRICS
+    if (reportStats) addStats(doc.createNestedObject("stats"));
+#endif
+    fillBatch(doc, pending, binary);
+    std::vector<char> buf((binary ? measureMsgPack(doc) : measureJson(doc)) + 2);
+    size_t len = serializeBody(doc, buf.data(), buf.size());
+
+    int status = 0;
+    size_t n = performRequest("/api/device/sync", "POST", (const uint8_t*)buf.data(), len, 1, &status,
+                              deltaSync ? syncRevision : noRevision, nullptr, &IOTServerClient::applyVariableStream);
+    // on failure the writes stay held and go into the next snapshot
+    if (status != 304 && n == 0) return false;
+
+    holdWrites = false;
+    lastHeartbeat = millis();
+    confirmQueued(pending);
+    runDeferred();
+    return true;
+}
+
+// Write filtering
+bool IOTServerClient::shouldSend(const Variable& v, const VarValue& value) {
+    const WritePolicy& p = v.policy;
+    if (p.mode == WRITE_ALWAYS || !v.known) return true;
+    if (p.maxSilence > 0 && millis() - v.lastPushAt >= p.maxSilence) return true;
+    if (v.value.type != value.type) return true;
+
+    bool numeric = value.type == INT_TYPE || value.type == FLOAT_TYPE;
+    if (p.mode == WRITE_ON_CHANGE || !numeric) return v.value != value;
+
+    float oldV = v.value.asFloat();
+    float delta = fabsf(value.asFloat() - oldV);
+    if (p.absDelta <= 0.0f && p.pctDelta <= 0.0f) return delta > 0.0f;
+    if (p.absDelta > 0.0f && delta > p.absDelta) return true;
+    if (p.pctDelta > 0.0f && delta > fabsf(oldV) * p.pctDelta / 100.0f) return true;
+    return false;
+}
+
+void IOTServerClient::setDeadband(const String& name, float absolute, float percent, unsigned long maxSilenceMs) {
+    int h = cache.insert(name, FLOAT_TYPE);
+    if (h == VariableCache::npos) return;
+    WritePolicy& p = cache.at(h).policy;
+    p.mode = WRITE_DEADBAND;
+    p.absDelta = absolute;
+    p.pctDelta = percent;
+    p.maxSilence = maxSilenceMs;
+}
+
+void IOTServerClient::setOnChange(const String& name, unsigned long maxSilenceMs) {
+    int h = cache.insert(name, STRING_TYPE);
+    if (h == VariableCache::npos) return;
+    WritePolicy& p = cache.at(h).policy;
+    p.mode = WRITE_ON_CHANGE;
+    p.maxSilence = maxSilenceMs;
+}
+
+void IOTServerClient::clearWritePolicy(const String& name) {
+    Variable* v = findInCache(name);
+    if (v) v->policy = WritePolicy();
+}
+
+// Batching
+void IOTServerClient::beginBatch() {
+    batching = true;
+}
+
+bool IOTServerClient::commitBatch() {
+    batching = false;
+    return sendBatch();
+}
+
+void IOTServerClient::cancelBatch() {
+    batching = false;
+    pending.clear();
+}
+
+void IOTServerClient::setBatchWindow(unsigned long ms) {
+    localBatchWindow = ms;
+    batchWindow = ms;
+}
+
+// sub-device writes wait for the gateway sync, apart from the gateway's own
+// batch so that beginBatch()/cancelBatch() don't reach them
+std::vector<IOTServerClient::PendingWrite>& IOTServerClient::writesFor(int slot) {
+    return cache.at(slot).device != 0 ? deviceWrites : pending;
+}
+
+void IOTServerClient::queueWrite(int slot, const VarValue& value) {
+    std::vector<PendingWrite>& queue = writesFor(slot);
+    for (auto &p : queue) {
+        if (p.slot == slot) { p.value = value; return; }
+    }
+    // the batch window runs from the oldest write waiting on it
+    if (deviceWrites.empty() && (batching || pending.empty())) batchStarted = millis();
+    PendingWrite pw; pw.slot = slot; pw.value = value;
+    queue.push_back(pw);
+}
+
+size_t IOTServerClient::batchDocSize(const std::vector<PendingWrite>& writes) {
+    // strings are copied into the document, so size it from the entries
+    size_t cap = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(writes.size());
+    for (auto &p : writes) {
+        cap += JSON_OBJECT_SIZE(4) + cache.at(p.slot).name.length() + p.value.s.length() + 32;
+    }
+    return cap;
+}
+
+void IOTServerClient::fillBatch(JsonDocument& doc, const std::vector<PendingWrite>& writes, bool binary) {
+    JsonArray arr = doc.createNestedArray("variables");
+    for (auto &p : writes) fillWrite(arr.createNestedObject(), p, binary);
+}
+
+void IOTServerClient::fillWrite(JsonObject o, const PendingWrite& p, bool binary) {
+    if (binary) {
+        packEntry(o, p.slot, p.value);
+    } else {
+        o["name"] = cache.at(p.slot).name;
+        o["value"] = p.value.toString();
+        o["type"] = varTypeName(p.value.type);
+    }
+    if (p.offline) o["age"] = millis() - p.at;
+}
+
+String IOTServerClient::batchPayload(const std::vector<PendingWrite>& writes) {
+    DynamicJsonDocument doc(batchDocSize(writes));
+    fillBatch(doc, writes, false);
+    String payload;
+    serializeJson(doc, payload);
+    return payload;
+}
+
+// blocking batch upload in the negotiated format; ids in the answer
+// ("ids": [...], one per entry) are learned
+bool IOTServerClient::postBatch(const std::vector<PendingWrite>& writes, int retries) {
+    bool binary = binaryWire();
+    DynamicJsonDocument doc(batchDocSize(writes));
+    fillBatch(doc, writes, binary);
+    std::vector<char> buf((binary ? measureMsgPack(doc) : measureJson(doc)) + 2);
+    size_t len = serializeBody(doc, buf.data(), buf.size());
+
+    rxBuf[0] = 0;
+    size_t n = performRequest("/api/device/variables/batch", "POST", (const uint8_t*)buf.data(), len, retries,
+                              nullptr, "", nullptr);
+    bool ok = handleVariableResponse(rxBuf, n);
+    if (ok && n > 0) {
+        JsonArrayConst ids = responseDoc["ids"].as<JsonArrayConst>();
+        for (size_t i = 0; i < writes.size() && i < ids.size(); i++) learnId(writes[i].slot, ids[i] | 0U);
+    }
+    return ok;
+}
+
+bool IOTServerClient::sendBatch() {
+    if (pending.empty() && deviceWrites.empty()) return true;
+    if (!devices.empty()) return gatewaySync();
+
+    if (asyncMode) {
+        // the request takes a copy; `pending` keeps its buffer
+        std::vector<PendingWrite> sent(pending);
+        auto done = [this, sent](int, const String& res) {
+            batchSent(sent, handleVariableResponse(res));
+        };
+        if (!enqueueRequest("/api/device/variables/batch", "POST", batchPayload(sent), 1, done)) return false;
+        pending.clear();
+        return true;
+    }
+
+    // on failure the entries stay queued and go out with the next flush
+    if (!postBatch(pending, 1)) { batchStarted = millis(); return false; }
+    confirmQueued(pending);
+    return true;
+}
+
+// confirms every write in queue and empties it. the buffer stays, so the
+// queues reserved by the fixed-capacity profile don't grow again
+void IOTServerClient::confirmQueued(std::vector<PendingWrite>& queue) {
+    for (size_t i = 0; i < queue.size(); i++) confirmWrite(queue[i].slot, queue[i].value);
+    queue.clear();
+}
+
+// Priorities
+void IOTServerClient::setPriority(const String& name, WritePriority p) {
+    int slot = cache.insert(name, STRING_TYPE);
+    if (slot != VariableCache::npos) cache.at(slot).priority = p;
+}
+
+void IOTServerClient::setBulkRate(unsigned long minIntervalMs, size_t maxPerRequest) {
+    localBulkInterval = minIntervalMs;
+    bulkInterval = minIntervalMs;
+    bulkMax = maxPerRequest > 0 ? maxPerRequest : 1;
+}
+
+void IOTServerClient::queueBulk(int slot, const VarValue& value) {
+    for (auto &p : bulk) {
+        if (p.slot == slot) { p.value = value; return; }
+    }
+    PendingWrite pw; pw.slot = slot; pw.value = value;
+    bulk.push_back(pw);
+}
+
+// the oldest bulkMax entries as one batch. they stay in `bulk` until the
+// answer, so a newer value written meanwhile simply replaces them there
+void IOTServerClient::sendBulk() {
+    lastBulkAt = millis();
+    size_t n = bulk.size() < bulkMax ? bulk.size() : bulkMax;
+    std::vector<PendingWrite> sent(bulk.begin(), bulk.begin() + n);
+    if (asyncMode) {
+        bulkInFlight = enqueueRequest("/api/device/variables/batch", "POST", batchPayload(sent), 0,
+            [this, sent](int, const String& res) {
+                bulkInFlight = false;
+                bulkDone(sent, handleVariableResponse(res));
+            });
+        return;
+    }
+    bulkDone(sent, postBatch(sent, 0));
+}
+
+// on failure everything stays queued for the next slot the rate allows
+void IOTServerClient::bulkDone(const std::vector<PendingWrite>& sent, bool ok) {
+    for (auto &p : sent) {
+        if (ok) {
+            confirmWrite(p.slot, p.value);
+            for (size_t i = 0; i < bulk.size(); i++) {
+                if (bulk[i].slot != p.slot) continue;
+                if (bulk[i].value == p.value) bulk.erase(bulk.begin() + i);
+                break;
+            }
+        }
+        if (asyncMode && writeResultCb) writeResultCb(cache.at(p.slot).name, ok);
+    }
+}
+
+// async completion of writes taken out of `pending` / `deviceWrites`
+void IOTServerClient::batchSent(const std::vector<PendingWrite>& sent, bool ok) {
+    for (auto &p : sent) {
+        if (ok) {
+            confirmWrite(p.slot, p.value);
+        } else {
+            // put back unless a newer value was queued meanwhile
+            bool newer = false;
+            for (auto &q : writesFor(p.slot)) if (q.slot == p.slot) { newer = true; break; }
+            if (!newer) queueWrite(p.slot, p.value);
+        }
+        if (writeResultCb) writeResultCb(cache.at(p.slot).name, ok);
+    }
+}
+
+// Gateway mode
+SubDevice IOTServerClient::addDevice(const String& deviceKey) {
+    if (devices.size() >= 255) return SubDevice();
+    GatewayDevice d;
+    d.key = deviceKey;
+    devices.push_back(d);
+    // the combined request is JSON
+    setWireFormat(WIRE_JSON);
+    return SubDevice(this, devices.size());
+}
+
+// member name up to the closing quote. longer names are cut to fit; they
+// only have to match the short ones the parsers know
+static bool readKey(Stream& in, char* key, size_t cap) {
+    size_t n = 0;
+    while (true) {
+        char c;
+        if (in.readBytes(&c, 1) != 1) return false;
+        if (c == '"') break;
+        if (n + 1 < cap) key[n++] = c;
+    }
+    key[n] = 0;
+    return true;
+}
+
+// v as text, into out's buffer when it is a string
+static void assignText(String& out, JsonVariantConst v) {
+    if (v.is<const char*>()) out = v.as<const char*>();
+    else out = v.as<String>();
+}
+
+// 0 for the gateway's own key, index + 1 for a sub-device, -1 if unknown
+int IOTServerClient::deviceIndex(const char* key) const {
+    if (deviceKey == key) return 0;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].key == key) return i + 1;
+    }
+    return -1;
+}
+
+size_t IOTServerClient::gatewayDocSize(const std::vector<PendingWrite>& writes) {
+    return batchDocSize(writes) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(8) +
+           (devices.size() + 1) * (JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(4));
+}
+
+// { ts, devices: [ { key, status, rev?, variables?: [ ... ] }, ... ] }, the
+// gateway itself first. keys and revisions are referenced, not copied
+void IOTServerClient::fillGateway(JsonDocument& doc, const std::vector<PendingWrite>& writes) {
+    doc["ts"] = millis();
+#if IOT_ENABLE_METRICS
+    if (reportStats) addStats(doc.createNestedObject("stats"));
+#endif
+    JsonArray list = doc.createNestedArray("devices");
+    for (size_t d = 0; d <= devices.size(); d++) {
+        JsonObject o = list.createNestedObject();
+        o["key"] = d == 0 ? deviceKey.c_str() : devices[d - 1].key.c_str();
+        o["status"] = "online";
+        const String& rev = d == 0 ? syncRevision : devices[d - 1].revision;
+        if (deltaSync && rev.length() > 0) o["rev"] = rev.c_str();
+        JsonArray vars;
+        for (auto &p : writes) {
+            if (cache.at(p.slot).device != d) continue;
+            if (vars.isNull()) vars = o.createNestedArray("variables");
+            fillWrite(vars.createNestedObject(), p, false);
+        }
+    }
+}
+
+// one sub-device write as a gateway sync of its own: only that device's entry,
+// without "status" or "rev", which the server takes as writes only (no
+// heartbeat, nothing pulled). false if it couldn't go out; it then waits for
+// the next full sync
+bool IOTServerClient::sendDeviceWrite(int slot, const VarValue& value) {
+    PendingWrite p; p.slot = slot; p.value = value;
+    std::vector<PendingWrite> one(1, p);
+    DynamicJsonDocument doc(batchDocSize(one) + JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(2));
+    doc["ts"] = millis();
+    JsonObject o = doc.createNestedArray("devices").createNestedObject();
+    o["key"] = devices[cache.at(slot).device - 1].key.c_str();
+    fillWrite(o.createNestedArray("variables").createNestedObject(), p, false);
+
+    if (asyncMode) {
+        String payload;
+        serializeJson(doc, payload);
+        auto done = [this, one](int status, const String& res) {
+            bool ok = status >= 200 && status < 300 && res.length() > 0;
+            if (ok) {
+                MemStream in(res.c_str(), res.length());
+                parseWait = 0;
+                ok = applyGatewayStream(in);
+            }
+            batchSent(one, ok);
+        };
+        return enqueueRequest("/api/gateway/sync", "POST", payload, 1, done, "", true);
+    }
+
+    std::vector<char> buf(measureJson(doc) + 2);
+    size_t len = serializeBody(doc, buf.data(), buf.size());
+    size_t n = performRequest("/api/gateway/sync", "POST", (const uint8_t*)buf.data(), len, 1, nullptr, "", nullptr,
+                              &IOTServerClient::applyGatewayStream);
+    if (n > 0) confirmWrite(slot, value);
+    runDeferred();
+    return n > 0;
+}
+
+// back into their queues, ahead of anything queued since
+void IOTServerClient::requeueWrites(std::vector<PendingWrite>& writes) {
+    for (auto &p : writes) {
+        std::vector<PendingWrite>& queue = writesFor(p.slot);
+        bool newer = false;
+        for (auto &q : queue) if (q.slot == p.slot) { newer = true; break; }
+        if (!newer) queue.insert(queue.begin(), p);
+    }
+    writes.clear();
+}
+
+// heartbeat, queued writes and the pull of every device in one POST. an open
+// beginBatch() keeps the gateway's own writes back until commitBatch()
+bool IOTServerClient::gatewaySync() {
+    // written into gatewaySent's buffer, handed back at the end (a callback
+    // running a nested sync just gets a buffer of its own)
+    std::vector<PendingWrite> sent;
+    sent.swap(gatewaySent);
+    sent.insert(sent.end(), deviceWrites.begin(), deviceWrites.end());
+    deviceWrites.clear();
+    if (!batching) {
+        sent.insert(sent.end(), pending.begin(), pending.end());
+        pending.clear();
+    }
+    DynamicJsonDocument doc(gatewayDocSize(sent));
+    fillGateway(doc, sent);
+    unsigned long changes = changeCount;
+
+    if (asyncMode) {
+        String payload;
+        serializeJson(doc, payload);
+        auto done = [this, sent, changes](int status, const String& res) {
+            bool ok = status >= 200 && status < 300 && res.length() > 0;
+            if (ok) {
+                MemStream in(res.c_str(), res.length());
+                parseWait = 0;
+                ok = applyGatewayStream(in);
+            }
+            batchSent(sent, ok);
+            if (ok) adaptPoll(changeCount != changes);
+            if (syncCb) syncCb(ok);
+        };
+        bool queued = enqueueRequest("/api/gateway/sync", "POST", payload, 1, done);
+        if (!queued) requeueWrites(sent);
+        sent.clear();
+        gatewaySent.swap(sent);
+        return queued;
+    }
+
+    std::vector<char> buf(measureJson(doc) + 2);
+    size_t len = serializeBody(doc, buf.data(), buf.size());
+    size_t n = performRequest("/api/gateway/sync", "POST", (const uint8_t*)buf.data(), len, 1, nullptr, "", nullptr,
+                              &IOTServerClient::applyGatewayStream);
+    // on failure the writes stay queued for the next one
+    if (n > 0) {
+        for (auto &p : sent) confirmWrite(p.slot, p.value);
+        adaptPoll(changeCount != changes);
+    } else {
+        requeueWrites(sent);
+    }
+    sent.clear();
+    gatewaySent.swap(sent);
+    runDeferred();
+    return n > 0;
+}
+
+// { poll?, devices: [ { key, revision?, variables: [ ... ] }, ... ] }, walked
+// like applyVariableStream. "key" has to come before "variables" in an entry
+bool IOTServerClient::applyGatewayStream(Stream& in) {
+    if (nextToken(in) != '{') return false;
+
+    bool sawDevices = false;
+    while (true) {
+        int c = nextToken(in);
+        if (c == ',') continue;
+        if (c == '}') break;
+        if (c != '"') return false;
+
+        char key[16];
+        if (!readKey(in, key, sizeof(key)) || nextToken(in) != ':') return false;
+        if (strcmp(key, "devices") == 0) {
+            bool ok = applyDeviceArray(in);
+            parseDevice = 0;
+            if (!ok) return false;
+            sawDevices = true;
+        } else if (strcmp(key, "config") == 0) {
+            if (!readConfig(in)) return false;
+        } else {
+            StaticJsonDocument<128> member;
+            if (!readMember(in, member)) return false;
+            if (strcmp(key, "poll") == 0) applyPollHint(member | 0UL);
+        }
+    }
+    return sawDevices;
+}
+
+bool IOTServerClient::applyDeviceArray(Stream& in) {
+    if (nextToken(in) != '[') return false;
+    if (nextToken(in, false) == ']') { in.read(); return true; }
+
+    while (true) {
+        if (nextToken(in) != '{') return false;
+        parseDevice = -1; // entries before "key" are dropped
+        String& revision = parseRevision;
+        revision = "";
+        while (true) {
+            int c = nextToken(in);
+            if (c == ',') continue;
+            if (c == '}') break;
+            if (c != '"') return false;
+
+            char key[16];
+            if (!readKey(in, key, sizeof(key)) || nextToken(in) != ':') return false;
+            if (strcmp(key, "variables") == 0) {
+                if (!applyVariableArray(in)) return false;
+                continue;
+            }
+            StaticJsonDocument<128> member;
+            if (!readMember(in, member)) return false;
+            if (strcmp(key, "key") == 0) parseDevice = deviceIndex(member | "");
+            else if (strcmp(key, "revision") == 0) assignText(revision, member.as<JsonVariantConst>());
+        }
+        if (deltaSync && parseDevice >= 0 && revision.length() > 0) {
+            if (parseDevice == 0) syncRevision = revision;
+            else devices[parseDevice - 1].revision = revision;
+        }
+
+        int c = nextToken(in);
+        if (c == ']') return true;
+        if (c != ',') return false;
+    }
+}
+
+// Time series
+bool IOTServerClient::addSeries(const String& name, size_t capacity, float resolution, unsigned long flushMs) {
+    int slot = cache.insert(name, FLOAT_TYPE);
+    if (slot == VariableCache::npos || capacity == 0 || resolution <= 0.0f) return false;
+    Series* s = nullptr;
+    for (auto &e : series) if (e.slot == slot) s = &e;
+    if (!s) {
+        series.push_back(Series());
+        s = &series.back();
+    }
+    s->slot = slot;
+    s->resolution = resolution;
+    s->flushMs = flushMs;
+    s->buf.reset(capacity);
+    s->inFlight = false;
+    return true;
+}
+
+bool IOTServerClient::appendSample(const String& name, float value, uint32_t ts) {
+    int slot = cache.find(name);
+    for (auto &s : series) {
+        if (s.slot != slot) continue;
+        if (s.buf.empty()) s.firstAt = millis();
+        Sample smp;
+        smp.ts = ts;
+        smp.v = value;
+        if (!s.buf.push(smp) && s.inFlight) s.overwritten++;
+        // latest value for virtualRead; the server gets it through the series
+        updateSlot(slot, VarValue::ofFloat(value), false);
+        return true;
+    }
+    return false;
+}
+
+bool IOTServerClient::flushSeries() {
+    bool all = true;
+    for (size_t i = 0; i < series.size(); i++) {
+        while (!series[i].buf.empty() && !series[i].inFlight) {
+            if (!uploadSeries(i)) break; // try again later
+        }
+        if (!series[i].buf.empty()) all = false;
+    }
+    return all;
+}
+
+// { n | i, t0, dt, v0, dv, res }: timestamps as deltas (dt is a single number
+// when the interval is constant), values as deltas of round(v / res). small
+// integers are 1 byte in MessagePack
+void IOTServerClient::fillSeries(JsonDocument& doc, const Series& s, size_t n, bool binary) {
+    const Variable& var = cache.at(s.slot);
+    if (binary && var.wireId != 0) doc["i"] = var.wireId;
+    else doc["n"] = var.name.c_str();
+    doc["res"] = s.resolution;
+
+    const Sample& first = s.buf.at(0);
+    long q = lroundf(first.v / s.resolution);
+    doc["t0"] = first.ts;
+    doc["v0"] = q;
+
+    bool even = true;
+    for (size_t k = 2; k < n && even; k++) {
+        even = s.buf.at(k).ts - s.buf.at(k - 1).ts == s.buf.at(1).ts - first.ts;
+    }
+    JsonArray dt;
+    if (n > 1 && even) doc["dt"] = s.buf.at(1).ts - first.ts;
+    else dt = doc.createNestedArray("dt");
+    JsonArray dv = doc.createNestedArray("dv");
+    for (size_t k = 1; k < n; k++) {
+        const Sample& smp = s.buf.at(k);
+        long next = lroundf(smp.v / s.resolution);
+        if (!dt.isNull()) dt.add(smp.ts - s.buf.at(k - 1).ts);
+        dv.add(next - q);
+        q = next;
+    }
+}
+
+bool IOTServerClient::uploadSeries(size_t index) {
+    Series& s = series[index];
+    if (!isConnected()) return false;
+    size_t n = s.buf.size();
+    if (n > IOT_SERIES_CHUNK) n = IOT_SERIES_CHUNK;
+    bool binary = binaryWire();
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(6) + 2 * JSON_ARRAY_SIZE(n) + cache.at(s.slot).name.length() + 16);
+    fillSeries(doc, s, n, binary);
+
+    if (asyncMode) {
+        String payload;
+        serializeJson(doc, payload);
+        s.overwritten = 0;
+        s.inFlight = enqueueRequest("/api/device/series", "POST", payload, 0, [this, index, n](int, const String& res) {
+            seriesDone(index, n, handleVariableResponse(res));
+        });
+        return s.inFlight;
+    }
+    std::vector<char> buf((binary ? measureMsgPack(doc) : measureJson(doc)) + 2);
+    size_t len = serializeBody(doc, buf.data(), buf.size());
+    rxBuf[0] = 0;
+    size_t got = performRequest("/api/device/series", "POST", (const uint8_t*)buf.data(), len, 0, nullptr, "", nullptr);
+    s.overwritten = 0;
+    bool ok = handleVariableResponse(rxBuf, got);
+    seriesDone(index, n, ok);
+    return ok;
+}
+
+void IOTServerClient::seriesDone(size_t index, size_t n, bool ok) {
+    Series& s = series[index];
+    s.inFlight = false;
+    size_t overwritten = s.overwritten;
+    s.overwritten = 0;
+    // on failure the samples stay and the next try waits a full flush period
+    s.firstAt = millis();
+    if (!ok) return;
+    s.buf.pop(n > overwritten ? n - overwritten : 0);
+}
+
+Variable* IOTServerClient::findInCache(const String& name, uint8_t device) {
+    return cache.get(name, device);
+}
+
+void IOTServerClient::updateSlot(int slot, const VarValue& value, bool remote) {
+    Variable& v = cache.at(slot);
+    bool changed = !v.known || v.value != value;
+    v.value = value;
+    v.known = true;
+    if (!changed) return;
+    if (slot < (int)sharedCount) shared[slot].store(value);
+    if (logReady && !v.logQueued) {
+        v.logQueued = true;
+        logDirty.push_back(slot);
+    }
+    if (!remote) return;
+    changeCount++;
+    if (v.callback == 0) return;
+    if (!deferCallbacks) { dispatch(slot); return; }
+    if (!v.dispatchQueued) {
+        v.dispatchQueued = true;
+        deferred.push_back(slot);
+    }
+}
+
+void IOTServerClient::dispatch(int slot) {
+    // copies: the callback may write the variable, and registering another
+    // callback can move `callbacks` (or replace this one) while it runs
+    VarValue value = cache.at(slot).value;
+    const CallbackEntry& cb = callbacks[cache.at(slot).callback - 1];
+    // match type and call if exists
+    if (value.type == INT_TYPE && cb.intCb) {
+        IntCallback fn = cb.intCb;
+        fn(value.i);
+    } else if (value.type == FLOAT_TYPE && cb.floatCb) {
+        FloatCallback fn = cb.floatCb;
+        fn(value.f);
+    } else if (value.type == BOOLEAN_TYPE && cb.boolCb) {
+        BoolCallback fn = cb.boolCb;
+        fn(value.b);
+    } else if (value.type == STRING_TYPE && cb.stringCb) {
+        StringCallback fn = cb.stringCb;
+        fn(value.s);
+    }
+}
+
+void IOTServerClient::runDeferred() {
+    // by index: a callback can queue further changes
+    for (size_t i = 0; i < deferred.size(); i++) {
+        cache.at(deferred[i]).dispatchQueued = false;
+        dispatch(deferred[i]);
+    }
+    deferred.clear();
+}
+
+void IOTServerClient::setDeferredCallbacks(bool enabled) {
+    deferCallbacks = enabled;
+    if (!enabled) runDeferred();
+}
+
+bool IOTServerClient::syncNow() {
+    if (!devices.empty()) return gatewaySync();
+    // by reference: a copy of the revision would be a heap String per sync
+    const String& rev = deltaSync ? syncRevision : noRevision;
+    if (asyncMode) {
+        return enqueueRequest("/api/device/variables", "GET", "", 1, [this](int status, const String& res) {
+            bool ok = handleSyncResponse(status, res);
+            if (syncCb) syncCb(ok);
+        }, rev);
+    }
+    int status = 0;
+    unsigned long changes = changeCount;
+    size_t n = performRequest("/api/device/variables", "GET", nullptr, 0, 1, &status, rev, nullptr,
+                              &IOTServerClient::applyVariableStream);
+    bool ok = status == 304 || n > 0;
+    if (ok) adaptPoll(changeCount != changes);
+    runDeferred();
+    return ok;
+}
+
+bool IOTServerClient::handleSyncResponse(int status, const String& res) {
+    unsigned long changes = changeCount;
+    bool ok = status == 304 || applyVariables(res); // 304: nothing changed since syncRevision
+    if (ok) adaptPoll(changeCount != changes);
+    return ok;
+}
+
+bool IOTServerClient::applyVariables(const String& res) {
+    if (res.length() == 0) return false;
+    MemStream in(res.c_str(), res.length());
+    parseWait = 0;
+    return applyVariableStream(in);
+}
+
+// Incremental parse of { revision?, delta?, variables: [ { name, type, value }, ... ] }.
+// Top-level members are walked by hand and each variable is deserialized into a
+// small document and applied on its own, so memory use doesn't grow with the
+// number of variables. A delta response carries only the changed entries;
+// applying them on top of the cache is the same operation as a full list.
+bool IOTServerClient::applyVariableStream(Stream& in) {
+    if (lastBinary) return applyPackedStream(in);
+    if (nextToken(in) != '{') return false;
+
+    String& revision = parseRevision;
+    revision = "";
+    bool sawVariables = false;
+    while (true) {
+        int c = nextToken(in);
+        if (c == ',') continue;
+        if (c == '}') break;
+        if (c != '"') return false;
+
+        char key[16]; // member names are plain identifiers
+        if (!readKey(in, key, sizeof(key)) || nextToken(in) != ':') return false;
+        if (strcmp(key, "variables") == 0) {
+            if (!applyVariableArray(in)) return false;
+            sawVariables = true;
+        } else if (strcmp(key, "config") == 0) {
+            if (!readConfig(in)) return false;
+        } else {
+            StaticJsonDocument<128> member;
+            if (!readMember(in, member)) return false;
+            if (strcmp(key, "revision") == 0) assignText(revision, member.as<JsonVariantConst>());
+            else if (strcmp(key, "poll") == 0) applyPollHint(member | 0UL);
+        }
+    }
+    if (!sawVariables) return false;
+
+    if (deltaSync) syncRevision = revision.length() > 0 ? revision : lastEtag;
+    return true;
+}
+
+bool IOTServerClient::applyVariableArray(Stream& in) {
+    if (nextToken(in) != '[') return false;
+    if (nextToken(in, false) == ']') { in.read(); return true; }
+
+    StaticJsonDocument<IOT_SYNC_ENTRY_DOC_SIZE> entry;
+    while (true) {
+        if (!readEntry(in, entry, false)) return false;
+        if (!entry.isNull()) applyEntry(entry.as<JsonObjectConst>());
+
+        int c = nextToken(in);
+        if (c == ']') return true;
+        if (c != ',') return false;
+    }
+}
+
+// one list entry into entry. one too large for the document is read past and
+// counted instead, leaving entry empty; false only if the stream is broken
+bool IOTServerClient::readEntry(Stream& in, JsonDocument& entry, bool packed) {
+    entry.clear();
+    EntryStream src(in, packed);
+    DeserializationError err = packed ? deserializeMsgPack(entry, src) : deserializeJson(entry, src);
+    if (!err) return true;
+    if (err != DeserializationError::NoMemory || !src.skipRest()) return false;
+    entry.clear();
+    entriesSkipped++;
+    return true;
+}
+
+// length from a MessagePack map ('m'), array ('a') or str ('s') header,
+// -1 if the next value is something else
+static long packHeader(Stream& in, char kind) {
+    uint8_t b;
+    if (in.readBytes((char*)&b, 1) != 1) return -1;
+    int wide = 0; // bytes in the length field that follows
+    if (kind == 'm') {
+        if ((b & 0xf0) == 0x80) return b & 0x0f;
+        wide = b == 0xde ? 2 : b == 0xdf ? 4 : 0;
+    } else if (kind == 'a') {
+        if ((b & 0xf0) == 0x90) return b & 0x0f;
+        wide = b == 0xdc ? 2 : b == 0xdd ? 4 : 0;
+    } else {
+        if ((b & 0xe0) == 0xa0) return b & 0x1f;
+        wide = b == 0xd9 ? 1 : b == 0xda ? 2 : b == 0xdb ? 4 : 0;
+    }
+    uint8_t len[4];
+    if (wide == 0 || in.readBytes((char*)len, wide) != (size_t)wide) return -1;
+    unsigned long n = 0;
+    for (int i = 0; i < wide; i++) n = (n << 8) | len[i];
+    return n > 0x7fffffffUL ? -1 : (long)n;
+}
+
+// MessagePack variant of applyVariableStream: same document, walked by its
+// headers (no lookahead needed), each entry decoded into a small document
+bool IOTServerClient::applyPackedStream(Stream& in) {
+    long members = packHeader(in, 'm');
+    if (members < 0) return false;
+
+    String& revision = parseRevision;
+    revision = "";
+    bool sawVariables = false;
+    StaticJsonDocument<IOT_SYNC_ENTRY_DOC_SIZE> entry;
+    for (long m = 0; m < members; m++) {
+        char key[16];
+        long len = packHeader(in, 's');
+        if (len < 0 || len >= (long)sizeof(key) || in.readBytes(key, len) != (size_t)len) return false;
+        key[len] = 0;
+        if (strcmp(key, "variables") == 0) {
+            long count = packHeader(in, 'a');
+            if (count < 0) return false;
+            for (long i = 0; i < count; i++) {
+                if (!readEntry(in, entry, true)) return false;
+                if (!entry.isNull()) applyEntry(entry.as<JsonObjectConst>());
+            }
+            sawVariables = true;
+        } else {
+            entry.clear();
+            if (deserializeMsgPack(entry, in)) return false;
+            if (strcmp(key, "revision") == 0) assignText(revision, entry.as<JsonVariantConst>());
+            else if (strcmp(key, "poll") == 0) applyPollHint(entry | 0UL);
+            else if (strcmp(key, "config") == 0) applyConfig(entry.as<JsonObjectConst>());
+        }
+    }
+    if (!sawVariables) return false;
+
+    if (deltaSync) syncRevision = revision.length() > 0 ? revision : lastEtag;
+    return true;
+}
+
+// v as the variable's type, into out: text goes through VarValue::set(),
+// native values (MessagePack, unquoted JSON) are taken as they are
+static void unpackValue(VarValue& out, JsonVariantConst v, VarType type) {
+    if (v.is<const char*>()) { out.set(v.as<const char*>(), type); return; }
+    out.type = type;
+    switch (type) {
+        case INT_TYPE: out.i = v.as<int32_t>(); break;
+        case FLOAT_TYPE: out.f = v.as<float>(); break;
+        case BOOLEAN_TYPE: out.b = v.as<bool>(); break;
+        default: assignText(out.s, v); break;
+    }
+}
+
+// one variable list entry: { name, type, value, id? } or the compact
+// { i, v } / { i?, n, t, v } form (see packEntry)
+void IOTServerClient::applyEntry(JsonObjectConst e) {
+    if (parseDevice < 0) return; // gateway mode: a device this gateway doesn't carry
+    uint8_t device = parseDevice;
+    // values are parsed into `scratch` and names looked up in place, so an
+    // entry for a known variable is applied without touching the heap
+    if (e.containsKey("name")) {
+        unpackValue(scratch, e["value"], stringToVarType(e["type"] | ""));
+        int slot = cache.insert(e["name"] | "", scratch.type, device);
+        if (slot == VariableCache::npos) return;
+        learnId(slot, e["id"] | 0U);
+        updateSlot(slot, scratch);
+        return;
+    }
+
+    unsigned id = e["i"] | 0U;
+    int slot = VariableCache::npos;
+    if (e.containsKey("n")) {
+        slot = cache.insert(e["n"] | "", (VarType)(e["t"] | (int)STRING_TYPE), device);
+        if (slot != VariableCache::npos) learnId(slot, id);
+    } else if (device == 0 && id < wireSlots.size()) {
+        slot = (int)wireSlots[id] - 1;
+    }
+    if (slot == VariableCache::npos) return; // id not known here; the next full sync names it
+
+    VarType type = e.containsKey("t") ? (VarType)(e["t"] | (int)STRING_TYPE) : cache.at(slot).value.type;
+    unpackValue(scratch, e["v"], type);
+    updateSlot(slot, scratch);
+}
+
+// one member value into doc. objects, arrays and strings end on their own
+// closing character; a bare number or literal is read up to the ',' or '}'
+// after it, which is left in the stream (ArduinoJson would swallow it and the
+// walk would then wait out parseWait for the next token)
+bool IOTServerClient::readMember(Stream& in, JsonDocument& doc) {
+    int c = nextToken(in, false);
+    if (c == '{' || c == '[' || c == '"') return !deserializeJson(doc, in);
+    char buf[32];
+    size_t n = 0;
+    while (true) {
+        c = nextToken(in, false);
+        if (c < 0) return false; // a member is always followed by ',' or '}'
+        if (c == ',' || c == '}' || c == ']') break;
+        if (n + 1 >= sizeof(buf)) return false;
+        buf[n++] = (char)in.read();
+    }
+    buf[n] = 0;
+    return n > 0 && !deserializeJson(doc, (const char*)buf, n);
+}
+
+// next non-whitespace character, -1 once nothing arrives within parseWait;
+// consume = false only peeks
+int IOTServerClient::nextToken(Stream& in, bool consume) {
+    unsigned long start = millis();
+    while (true) {
+        int c = in.available() > 0 ? in.peek() : -1;
+        if (c < 0) {
+            if (millis() - start >= parseWait) return -1;
+            yield();
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') { in.read(); continue; }
+        if (consume) in.read();
+        return c;
+    }
+}
+
+// Task mode
+#if defined(ESP32)
+bool IOTServerClient::startTask(uint8_t core, uint32_t stackSize, uint8_t priority) {
+    if (netTask) return true;
+    sharedCount = cache.size();
+    shared.reset(new SeqlockValue[sharedCount]);
+    for (size_t i = 0; i < sharedCount; i++) shared[i].store(cache.at(i).value);
+    taskWrites.reset(IOT_TASK_QUEUE_SIZE);
+    taskMode = true;
+    if (xTaskCreatePinnedToCore(&IOTServerClient::taskMain, "iot", stackSize, this, priority, &netTask, core) != pdPASS) {
+        netTask = nullptr;
+        taskMode = false;
+        return false;
+    }
+    return true;
+}
+
+void IOTServerClient::taskMain(void* self) {
+    IOTServerClient* c = static_cast<IOTServerClient*>(self);
+    for (;;) {
+        c->pumpTaskWrites();
+        c->loop();
+        vTaskDelay(1); // let the idle task feed the watchdog
+    }
+}
+#endif
+
+VarValue IOTServerClient::readShared(int slot) const {
+    return slot < (int)sharedCount ? shared[slot].load() : VarValue();
+}
+
+bool IOTServerClient::postWrite(int slot, const VarValue& value) {
+#if defined(ESP32)
+    // callbacks run on the network task and may write directly
+    if (xTaskGetCurrentTaskHandle() == netTask) return writeSlot(slot, value);
+#endif
+    TaskWrite w;
+    w.slot = slot;
+    w.value = value;
+    return taskWrites.push(w);
+}
+
+void IOTServerClient::pumpTaskWrites() {
+    TaskWrite w;
+    while (taskWrites.pop(w)) writeSlot(w.slot, w.value);
+}
+
+// Read methods
+int IOTServerClient::virtualReadInt(const String& name) {
+    Variable* v = findInCache(name);
+    if (!v) return 0;
+    return v->value.asInt();
+}
+float IOTServerClient::virtualReadFloat(const String& name) {
+    Variable* v = findInCache(name);
+    if (!v) return 0.0f;
+    return v->value.asFloat();
+}
+bool IOTServerClient::virtualReadBool(const String& name) {
+    Variable* v = findInCache(name);
+    if (!v) return false;
+    return v->value.asBool();
+}
+String IOTServerClient::virtualReadString(const String& name) {
+    Variable* v = findInCache(name);
+    if (!v) return String("");
+    return v->value.toString();
+}
+size_t IOTServerClient::virtualReadString(const String& name, char* buf, size_t cap) {
+    Variable* v = findInCache(name);
+    if (!v) {
+        if (cap > 0) buf[0] = 0;
+        return 0;
+    }
+    return v->value.copyTo(buf, cap);
+}
+
+// Callback registration
+// the entry lives in callbacks[]; the variable keeps its index
+IOTServerClient::CallbackEntry* IOTServerClient::callbackFor(const String& name, VarType type, uint8_t device) {
+    int slot = cache.insert(name, type, device);
+    return slot == VariableCache::npos ? nullptr : callbackAt(slot);
+}
+IOTServerClient::CallbackEntry* IOTServerClient::callbackAt(int slot) {
+    Variable& v = cache.at(slot);
+    if (v.callback == 0) {
+#if IOT_MAX_VARIABLES > 0
+        if (callbacks.size() >= IOT_MAX_CALLBACKS) return nullptr; // table full
+#endif
+        callbacks.push_back(CallbackEntry());
+        v.callback = callbacks.size();
+    }
+    return &callbacks[v.callback - 1];
+}
+void IOTServerClient::onWriteInt(const String& name, IntCallback cb) {
+    CallbackEntry* e = callbackFor(name, INT_TYPE);
+    if (e) e->intCb = cb;
+}
+void IOTServerClient::onWriteFloat(const String& name, FloatCallback cb) {
+    CallbackEntry* e = callbackFor(name, FLOAT_TYPE);
+    if (e) e->floatCb = cb;
+}
+void IOTServerClient::onWriteBool(const String& name, BoolCallback cb) {
+    CallbackEntry* e = callbackFor(name, BOOLEAN_TYPE);
+    if (e) e->boolCb = cb;
+}
+void IOTServerClient::onWriteString(const String& name, StringCallback cb) {
+    CallbackEntry* e = callbackFor(name, STRING_TYPE);
+    if (e) e->stringCb = cb;
+}
+
+// two pointers fit std::function's inline storage
+void IOTServerClient::onWriteInt(const String& name, void (*fn)(void*, int), void* ctx) {
+    onWriteInt(name, IntCallback([fn, ctx](int v) { fn(ctx, v); }));
+}
+void IOTServerClient::onWriteFloat(const String& name, void (*fn)(void*, float), void* ctx) {
+    onWriteFloat(name, FloatCallback([fn, ctx](float v) { fn(ctx, v); }));
+}
+void IOTServerClient::onWriteBool(const String& name, void (*fn)(void*, bool), void* ctx) {
+    onWriteBool(name, BoolCallback([fn, ctx](bool v) { fn(ctx, v); }));
+}
+void IOTServerClient::onWriteString(const String& name, void (*fn)(void*, const String&), void* ctx) {
+    onWriteString(name, StringCallback([fn, ctx](const String& v) { fn(ctx, v); }));
+}
+
+// Handles
+IntHandle IOTServerClient::declareInt(const String& name) {
+    return IntHandle(this, cache.insert(name, INT_TYPE));
+}
+FloatHandle IOTServerClient::declareFloat(const String& name) {
+    return FloatHandle(this, cache.insert(name, FLOAT_TYPE));
+}
+BoolHandle IOTServerClient::declareBool(const String& name) {
+    return BoolHandle(this, cache.insert(name, BOOLEAN_TYPE));
+}
+StringHandle IOTServerClient::declareString(const String& name) {
+    return StringHandle(this, cache.insert(name, STRING_TYPE));
+}
+
+const String& VarHandle::name() const {
+    static const String none;
+    return valid() ? client->cache.at(slot).name : none;
+}
+// in task mode reads come from the published copy, never from the cache
+int VarHandle::readInt() const {
+    if (!valid()) return 0;
+    return client->taskMode ? client->readShared(slot).asInt() : client->cache.at(slot).value.asInt();
+}
+float VarHandle::readFloat() const {
+    if (!valid()) return 0.0f;
+    return client->taskMode ? client->readShared(slot).asFloat() : client->cache.at(slot).value.asFloat();
+}
+bool VarHandle::readBool() const {
+    if (!valid()) return false;
+    return client->taskMode ? client->readShared(slot).asBool() : client->cache.at(slot).value.asBool();
+}
+String VarHandle::readString() const {
+    if (!valid()) return String("");
+    return client->taskMode ? client->readShared(slot).toString() : client->cache.at(slot).value.toString();
+}
+size_t VarHandle::readString(char* buf, size_t cap) const {
+    if (!valid()) {
+        if (cap > 0) buf[0] = 0;
+        return 0;
+    }
+    return client->taskMode ? client->readShared(slot).copyTo(buf, cap) : client->cache.at(slot).value.copyTo(buf, cap);
+}
+bool VarHandle::writeValue(const VarValue& value) {
+    if (!valid()) return false;
+    return client->taskMode ? client->postWrite(slot, value) : client->writeSlot(slot, value);
+}
+
+void VarHandle::setCallback(IntCallback cb) {
+    IOTServerClient::CallbackEntry* e = client->callbackAt(slot);
+    if (e) e->intCb = cb;
+}
+void VarHandle::setCallback(FloatCallback cb) {
+    IOTServerClient::CallbackEntry* e = client->callbackAt(slot);
+    if (e) e->floatCb = cb;
+}
+void VarHandle::setCallback(BoolCallback cb) {
+    IOTServerClient::CallbackEntry* e = client->callbackAt(slot);
+    if (e) e->boolCb = cb;
+}
+void VarHandle::setCallback(StringCallback cb) {
+    IOTServerClient::CallbackEntry* e = client->callbackAt(slot);
+    if (e) e->stringCb = cb;
+}
+
+void IntHandle::onChange(IntCallback cb) { if (valid()) setCallback(cb); }
+void FloatHandle::onChange(FloatCallback cb) { if (valid()) setCallback(cb); }
+void BoolHandle::onChange(BoolCallback cb) { if (valid()) setCallback(cb); }
+void StringHandle::onChange(StringCallback cb) { if (valid()) setCallback(cb); }
+
+// Sub-devices
+const String& SubDevice::key() const {
+    static const String none;
+    return valid() ? client->devices[device - 1].key : none;
+}
+
+bool SubDevice::virtualWrite(const String& name, int value) {
+    return valid() && client->writeVariable(name, VarValue::ofInt(value), device);
+}
+bool SubDevice::virtualWrite(const String& name, float value) {
+    return valid() && client->writeVariable(name, VarValue::ofFloat(value), device);
+}
+bool SubDevice::virtualWrite(const String& name, bool value) {
+    return valid() && client->writeVariable(name, VarValue::ofBool(value), device);
+}
+bool SubDevice::virtualWrite(const String& name, const String& value) {
+    return valid() && client->writeVariable(name, VarValue::ofString(value), device);
+}
+
+int SubDevice::virtualReadInt(const String& name) {
+    Variable* v = valid() ? client->findInCache(name, device) : nullptr;
+    return v ? v->value.asInt() : 0;
+}
+float SubDevice::virtualReadFloat(const String& name) {
+    Variable* v = valid() ? client->findInCache(name, device) : nullptr;
+    return v ? v->value.asFloat() : 0.0f;
+}
+bool SubDevice::virtualReadBool(const String& name) {
+    Variable* v = valid() ? client->findInCache(name, device) : nullptr;
+    return v ? v->value.asBool() : false;
+}
+String SubDevice::virtualReadString(const String& name) {
+    Variable* v = valid() ? client->findInCache(name, device) : nullptr;
+    return v ? v->value.toString() : String("");
+}
+size_t SubDevice::virtualReadString(const String& name, char* buf, size_t cap) {
+    Variable* v = valid() ? client->findInCache(name, device) : nullptr;
+    if (v) return v->value.copyTo(buf, cap);
+    if (cap > 0) buf[0] = 0;
+    return 0;
+}
+
+IntHandle SubDevice::declareInt(const String& name) {
+    return valid() ? IntHandle(client, client->cache.insert(name, INT_TYPE, device)) : IntHandle();
+}
+FloatHandle SubDevice::declareFloat(const String& name) {
+    return valid() ? FloatHandle(client, client->cache.insert(name, FLOAT_TYPE, device)) : FloatHandle();
+}
+BoolHandle SubDevice::declareBool(const String& name) {
+    return valid() ? BoolHandle(client, client->cache.insert(name, BOOLEAN_TYPE, device)) : BoolHandle();
+}
+StringHandle SubDevice::declareString(const String& name) {
+    return valid() ? StringHandle(client, client->cache.insert(name, STRING_TYPE, device)) : StringHandle();
+}
+
+void SubDevice::onWriteInt(const String& name, IntCallback cb) {
+    IOTServerClient::CallbackEntry* e = valid() ? client->callbackFor(name, INT_TYPE, device) : nullptr;
+    if (e) e->intCb = cb;
+}
+void SubDevice::onWriteFloat(const String& name, FloatCallback cb) {
+    IOTServerClient::CallbackEntry* e = valid() ? client->callbackFor(name, FLOAT_TYPE, device) : nullptr;
+    if (e) e->floatCb = cb;
+}
+void SubDevice::onWriteBool(const String& name, BoolCallback cb) {
+    IOTServerClient::CallbackEntry* e = valid() ? client->callbackFor(name, BOOLEAN_TYPE, device) : nullptr;
+    if (e) e->boolCb = cb;
+}
+void SubDevice::onWriteString(const String& name, StringCallback cb) {
+    IOTServerClient::CallbackEntry* e = valid() ? client->callbackFor(name, STRING_TYPE, device) : nullptr;
+    if (e) e->stringCb = cb;
 }
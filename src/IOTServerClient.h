@@ -5,23 +5,200 @@
 #include <ArduinoJson.h>
 #include <WiFiClient.h>
 #include <HTTPClient.h>
+// TLS for https:// server URLs; on by default where the core provides it
+#ifndef IOT_ENABLE_TLS
+#if defined(ESP32) || defined(ESP8266)
+#define IOT_ENABLE_TLS 1
+#else
+#define IOT_ENABLE_TLS 0
+#endif
+#endif
+#if IOT_ENABLE_TLS
+#include <WiFiClientSecure.h>
+#endif
 #include <vector>
 #include <functional>
-
-// public variable types
-enum VarType { INT_TYPE, FLOAT_TYPE, STRING_TYPE, BOOLEAN_TYPE };
-
-struct Variable {
-    String name;
-    VarType type;
-    String value;
-};
+#include <memory>
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#include "AsyncHttp.h"
+#include "CircuitBreaker.h"
+#include "VariableCache.h"
+#include "RingBuffer.h"
+#include "IStorageAdapter.h"
+#include "ITransportAdapter.h"
+#include "SharedState.h"
+#include "Metrics.h"
+#include "Deflate.h"
 
 typedef std::function<void(const String&)> StringCallback;
 typedef std::function<void(int)> IntCallback;
 typedef std::function<void(float)> FloatCallback;
 typedef std::function<void(bool)> BoolCallback;
 
+// fixed buffers for the blocking heartbeat/variable path, so building a
+// payload or reading a small response doesn't touch the heap
+#ifndef IOT_TX_BUFFER_SIZE
+#define IOT_TX_BUFFER_SIZE 384
+#endif
+#ifndef IOT_RX_BUFFER_SIZE
+#define IOT_RX_BUFFER_SIZE 512
+#endif
+// syncNow parses the variable list one entry at a time; this bounds one entry.
+// an entry that doesn't fit (a string value of roughly 300+ bytes at the
+// default) is skipped and counted in skippedEntries(), the rest still apply
+#ifndef IOT_SYNC_ENTRY_DOC_SIZE
+#define IOT_SYNC_ENTRY_DOC_SIZE 384
+#endif
+// request statistics (getStats); off by default to save RAM and cycles
+#ifndef IOT_ENABLE_METRICS
+#define IOT_ENABLE_METRICS 0
+#endif
+// writes other tasks can have queued for the network task (startTask)
+#ifndef IOT_TASK_QUEUE_SIZE
+#define IOT_TASK_QUEUE_SIZE 32
+#endif
+// time series: most samples one upload request carries
+#ifndef IOT_SERIES_CHUNK
+#define IOT_SERIES_CHUNK 100
+#endif
+// largest "config" member of a variable list answer (heartbeat answers are
+// bounded by IOT_RX_BUFFER_SIZE instead)
+#ifndef IOT_CONFIG_DOC_SIZE
+#define IOT_CONFIG_DOC_SIZE 384
+#endif
+// compressed answers (setCompression) are inflated through a window of
+// 1 << IOT_INFLATE_WINDOW_BITS bytes, allocated on the first one
+#ifndef IOT_INFLATE_WINDOW_BITS
+#if defined(ESP8266)
+#define IOT_INFLATE_WINDOW_BITS 12
+#else
+#define IOT_INFLATE_WINDOW_BITS 15
+#endif
+#endif
+// request bodies shorter than this are never compressed
+#ifndef IOT_COMPRESS_MIN
+#define IOT_COMPRESS_MIN 256
+#endif
+// server-assigned variable ids at or above this are ignored (names are sent instead)
+#ifndef IOT_MAX_WIRE_ID
+#define IOT_MAX_WIRE_ID 512
+#endif
+
+// ESP8266 TLS receive buffer (bytes, 512-16384); 0 keeps the core's 16 KB.
+// smaller sizes need a server that supports the max fragment length extension
+#ifndef IOT_TLS_BUFFER_SIZE
+#define IOT_TLS_BUFFER_SIZE 0
+#endif
+
+// fixed-capacity profile (set as build flags, see README): with
+// IOT_MAX_VARIABLES > 0 the cache, callback table and write queues are
+// allocated once in the constructor and never grow; inserts past the limit fail
+#ifndef IOT_MAX_VARIABLES
+#define IOT_MAX_VARIABLES 0
+#endif
+#ifndef IOT_MAX_CALLBACKS
+#define IOT_MAX_CALLBACKS IOT_MAX_VARIABLES
+#endif
+// buffer reserved per variable name / string value in that profile
+#ifndef IOT_MAX_NAME_LENGTH
+#define IOT_MAX_NAME_LENGTH 24
+#endif
+#ifndef IOT_MAX_STRING_LENGTH
+#define IOT_MAX_STRING_LENGTH 32
+#endif
+
+// body encoding on the wire
+enum WireFormat { WIRE_JSON, WIRE_MSGPACK };
+
+// async completion callbacks
+typedef std::function<void(bool ok)> ResultCallback;
+typedef std::function<void(const String& name, bool ok)> WriteResultCallback;
+
+class IOTServerClient;
+class SubDevice;
+
+// Pre-resolved reference to one cached variable, returned by declareXxx().
+// Reads and writes go straight to the cache slot without a name lookup.
+class VarHandle {
+public:
+    VarHandle() {}
+    bool valid() const { return client != nullptr && slot >= 0; }
+    const String& name() const;
+
+    int readInt() const;
+    float readFloat() const;
+    bool readBool() const;
+    String readString() const;
+    // into the caller's buffer (NUL-terminated, cut to cap - 1), without
+    // building a String; returns the length copied
+    size_t readString(char* buf, size_t cap) const;
+
+protected:
+    friend class IOTServerClient;
+    VarHandle(IOTServerClient* c, int s) : client(c), slot(s) {}
+    bool writeValue(const VarValue& value);
+    // by slot, so sub-device handles (gateway mode) register on their own variable
+    void setCallback(IntCallback cb);
+    void setCallback(FloatCallback cb);
+    void setCallback(BoolCallback cb);
+    void setCallback(StringCallback cb);
+
+    IOTServerClient* client = nullptr;
+    int slot = -1;
+};
+
+class IntHandle : public VarHandle {
+public:
+    IntHandle() {}
+    int read() const { return readInt(); }
+    bool write(int value) { return writeValue(VarValue::ofInt(value)); }
+    void onChange(IntCallback cb);
+private:
+    friend class IOTServerClient;
+    friend class SubDevice;
+    IntHandle(IOTServerClient* c, int s) : VarHandle(c, s) {}
+};
+
+class FloatHandle : public VarHandle {
+public:
+    FloatHandle() {}
+    float read() const { return readFloat(); }
+    bool write(float value) { return writeValue(VarValue::ofFloat(value)); }
+    void onChange(FloatCallback cb);
+private:
+    friend class IOTServerClient;
+    friend class SubDevice;
+    FloatHandle(IOTServerClient* c, int s) : VarHandle(c, s) {}
+};
+
+class BoolHandle : public VarHandle {
+public:
+    BoolHandle() {}
+    bool read() const { return readBool(); }
+    bool write(bool value) { return writeValue(VarValue::ofBool(value)); }
+    void onChange(BoolCallback cb);
+private:
+    friend class IOTServerClient;
+    friend class SubDevice;
+    BoolHandle(IOTServerClient* c, int s) : VarHandle(c, s) {}
+};
+
+class StringHandle : public VarHandle {
+public:
+    StringHandle() {}
+    String read() const { return readString(); }
+    size_t read(char* buf, size_t cap) const { return readString(buf, cap); }
+    bool write(const String& value) { return writeValue(VarValue::ofString(value)); }
+    void onChange(StringCallback cb);
+private:
+    friend class IOTServerClient;
+    friend class SubDevice;
+    StringHandle(IOTServerClient* c, int s) : VarHandle(c, s) {}
+};
+
 class IOTServerClient {
 public:
     // deviceKey: issued by server (long-lived API key)
@@ -37,61 +214,618 @@ public:
     // set heartbeat interval (ms)
     void setHeartbeatInterval(unsigned long ms);
 
+    // adaptive heartbeat: any answered request counts as liveness, so the
+    // separate heartbeat POST is dropped and the variable pull doubles as it,
+    // going out only when the device has been quiet for the heartbeat interval
+    // or a poll is due. the poll interval follows a "poll" (ms) hint from the
+    // server when given, else drops to minPollMs after a pull that changed
+    // something and grows 1.5x per unchanged pull up to maxPollMs. while a
+    // push transport is connected, pulls are only made for liveness.
+    // the server must treat every request with X-DEVICE-KEY as a heartbeat.
+    void setAdaptiveHeartbeat(bool enabled, unsigned long minPollMs = 5000, unsigned long maxPollMs = 300000);
+    unsigned long getPollInterval() const { return pollInterval; }
+    unsigned long getHeartbeatInterval() const { return heartbeatInterval; }
+
+    // server-driven configuration: a "config" object in the heartbeat or
+    // variable list answer overrides heartbeat interval, batch window, bulk
+    // rate, wire format and per-variable write policies at runtime (see
+    // README). on by default; off ignores it
+    void setRemoteConfig(bool enabled);
+
+    // keep the TCP connection to the server open between requests.
+    // the socket is closed after idleTimeoutMs without traffic.
+    void setKeepAlive(bool enabled, unsigned long idleTimeoutMs = 15000UL);
+
+    // TLS, used when the server URL is https:// (IOT_ENABLE_TLS). https
+    // connections are kept alive by default (60 s idle) so the handshake is
+    // paid once, not per request; on ESP8266 reconnects also resume the TLS
+    // session. trust the server's CA, or its own certificate to pin it (PEM,
+    // parsed once on ESP8266; on ESP32 the text must outlive the client)
+    void setCACert(const char* pem);
+    // pin the certificate's SHA-1 fingerprint instead; ESP8266 only, false elsewhere
+    bool setFingerprint(const uint8_t sha1[20]);
+    // skip certificate checks (testing only)
+    void setInsecure();
+    bool isSecure() const { return secure; }
+
+    // async mode: heartbeat, sync and writes are queued and driven from loop()
+    // one small step at a time, so loop() never waits on the server.
+    // virtualWrite/syncNow then return true once queued; results arrive via
+    // the callbacks below. keep-alive applies to the blocking mode only.
+    void setAsync(bool enabled);
+    bool isBusy(); // a request is queued or in flight
+    void onHeartbeatResult(ResultCallback cb);
+    void onSyncResult(ResultCallback cb);
+    void onWriteResult(WriteResultCallback cb);
+
+    // route heartbeat, push and pull through a transport adapter instead of the
+    // built-in HTTP client (nullptr restores it). an adapter that supports push
+    // is also used as the push channel. in async mode adapter calls are made
+    // from loop() as they come up, so they should be quick.
+    void setTransport(ITransportAdapter* t);
+
+    // persistent push channel (e.g. MqttAdapter): variable changes the server
+    // publishes are applied to the cache and fire callbacks as soon as they
+    // arrive instead of at the next heartbeat. requests still go over HTTP.
+    void setPushTransport(ITransportAdapter* t);
+
+    // per-request timeout (ms)
+    void setRequestTimeout(unsigned long ms);
+
+    // retry policy for all requests: a retry waits baseMs doubling up to maxMs,
+    // with jitter. after `threshold` consecutive failed attempts (no answer,
+    // 5xx or 429) the circuit opens and requests fail without touching the
+    // network; a single probe is let through after a cool-down (1 s doubling
+    // to maxMs). defaults: 200 ms, 60 s, 3.
+    void setBackoff(unsigned long baseMs, unsigned long maxMs, uint8_t threshold = 3);
+    CircuitBreaker::State circuitState() const { return breaker.state(); }
+
+    // delta sync: syncNow() sends the last seen revision (If-None-Match) and
+    // the server answers 304 or only the variables changed since then
+    void setDeltaSync(bool enabled);
+    const String& getSyncRevision() const { return syncRevision; }
+
+    // WIRE_MSGPACK: advertise MessagePack (Accept header) and switch to it once
+    // the server answers in kind; a JSON answer switches back. in MessagePack
+    // variables are sent by the numeric id the server assigns on first write.
+    // only the blocking built-in HTTP path; async mode and adapters stay JSON.
+    void setWireFormat(WireFormat f);
+    bool binaryWire() const; // MessagePack negotiated and in use
+
+    // deflate (zlib) content coding: requests advertise Accept-Encoding:
+    // deflate and compressed answers are inflated as they are parsed. once the
+    // server has answered compressed, bodies of IOT_COMPRESS_MIN bytes or more
+    // go out compressed too (a 415 switches that off until setCompression()).
+    // only the blocking built-in HTTP path, as for setWireFormat.
+    void setCompression(bool enabled);
+    bool compressionActive() const { return compression && deflateAccepted && !deflateRejected; }
+
     // write variables (sends to server and updates local cache)
     bool virtualWrite(const String& name, int value);
     bool virtualWrite(const String& name, float value);
     bool virtualWrite(const String& name, bool value);
     bool virtualWrite(const String& name, const String& value);
 
+    // write filtering, checked against the cached value before anything is sent.
+    // a suppressed write returns true and leaves the cache at the last value
+    // sent, so slow drift still crosses the deadband eventually.
+    // deadband: send when the change exceeds `absolute`, or `percent` % of the
+    // old value (numeric types; other types fall back to on-change).
+    // maxSilenceMs forces a send after that long without one (0 = never).
+    void setDeadband(const String& name, float absolute, float percent = 0.0f, unsigned long maxSilenceMs = 0);
+    void setOnChange(const String& name, unsigned long maxSilenceMs = 0);
+    void clearWritePolicy(const String& name);
+
+    // offline queue: while WiFi is down or a write fails, writes are kept with
+    // their timestamp in a ring buffer of `capacity` entries, applied to the
+    // local cache, and replayed in batches once the server is reachable again.
+    // the oldest entries are dropped on overflow. 0 = off (writes just fail).
+    void setOfflineQueue(size_t capacity);
+    size_t offlineQueued() const { return offlineQueue.size(); }
+
+    // variable list entries (sync, pull, cache log) skipped since start because
+    // they don't fit IOT_SYNC_ENTRY_DOC_SIZE
+    unsigned long skippedEntries() const { return entriesSkipped; }
+
+    // optional persistence; with a storage adapter the offline queue survives
+    // a reboot. set before begin().
+    void setStorage(IStorageAdapter* s);
+
+    // cache persistence (needs setStorage, set before begin()): every change
+    // to a variable is appended to a log in storage from loop(), at most every
+    // flushMs (a variable changed several times in between is written once).
+    // once the log passes compactBytes it is rewritten with one line per
+    // variable. begin() restores the cache from it and fires the callbacks
+    // registered so far with the restored values.
+    void setCachePersistence(bool enabled, unsigned long flushMs = 2000UL, size_t compactBytes = 4096);
+    // append pending changes now, e.g. before a planned restart
+    bool flushCacheLog();
+
+    // deep-sleep cycle, set before begin() together with setStorage()
+    // (RtcStorage keeps the snapshot through deep sleep without flash wear).
+    // begin() restores the cache, sync revision and unsent writes saved by
+    // prepareSleep() without firing callbacks, so virtualRead*() answers before
+    // the radio is up. writes are held until wakeSync(), which sends them, the
+    // heartbeat and the pull of changed variables as a single request.
+    void setSleepCycle(bool enabled);
+    bool wakeSync();
+    // save the snapshot and close the connection; call right before sleeping.
+    // false if the storage didn't take it (RtcStorage: IOT_RTC_STORAGE_SIZE)
+    bool prepareSleep();
+    // size of the snapshot the last prepareSleep() built, 0 if none
+    size_t snapshotBytes() const { return snapBytes; }
+
+    // batching: between beginBatch() and commitBatch() writes are queued and
+    // sent as a single request. repeated writes to one name keep the latest value.
+    void beginBatch();
+    bool commitBatch();
+    void cancelBatch();
+    // auto-batch every write and flush from loop() after `ms` (0 = off)
+    void setBatchWindow(unsigned long ms);
+
+    // outbound priority of a variable's writes. PRIORITY_CRITICAL skips
+    // batching, the batch window and the offline backlog (it queues offline
+    // only while unreachable) and, in async mode, goes ahead of everything
+    // queued. PRIORITY_BULK writes are held, repeated writes to a
+    // name keep the latest value, and uploaded as batches paced by
+    // setBulkRate(). PRIORITY_NORMAL (default) is sent as described above.
+    void setPriority(const String& name, WritePriority p);
+    // bulk uploads: at most one per minIntervalMs, maxPerRequest entries each
+    // (defaults 10 s, 20)
+    void setBulkRate(unsigned long minIntervalMs, size_t maxPerRequest = 20);
+    size_t bulkQueued() const { return bulk.size(); }
+
+    // time series for high-rate sensors: samples go into a ring of `capacity`
+    // entries allocated here and are uploaded from loop() in delta-encoded
+    // chunks (up to IOT_SERIES_CHUNK samples) once a chunk is full or the
+    // oldest sample is flushMs old. values are quantized to `resolution`.
+    // on overflow the oldest samples are dropped. timestamps are in whatever
+    // clock the sketch uses; the default is millis().
+    bool addSeries(const String& name, size_t capacity, float resolution = 0.001f, unsigned long flushMs = 1000);
+    bool appendSample(const String& name, float value) { return appendSample(name, value, millis()); }
+    bool appendSample(const String& name, float value, uint32_t ts);
+    // upload everything buffered now (blocking mode), false if something is left
+    bool flushSeries();
+
     // read cached variable (no network). returns 0 / "" / false if not found
     int virtualReadInt(const String& name);
     float virtualReadFloat(const String& name);
     bool virtualReadBool(const String& name);
     String virtualReadString(const String& name);
+    // the value as text into buf (NUL-terminated, cut to cap - 1), no String
+    // built; returns the length copied, 0 if not found
+    size_t virtualReadString(const String& name, char* buf, size_t cap);
+
+    // resolve a name once and get a handle for lookup-free reads/writes:
+    //   FloatHandle t = iot.declareFloat("temperature"); t.write(x); t.read();
+    IntHandle declareInt(const String& name);
+    FloatHandle declareFloat(const String& name);
+    BoolHandle declareBool(const String& name);
+    StringHandle declareString(const String& name);
 
     // register callbacks (device reacts when server-side value changes)
     void onWriteInt(const String& name, IntCallback cb);
     void onWriteFloat(const String& name, FloatCallback cb);
     void onWriteBool(const String& name, BoolCallback cb);
     void onWriteString(const String& name, StringCallback cb);
+    // the same with a plain function and a context pointer: nothing is
+    // captured, so the callback never needs the heap
+    void onWriteInt(const String& name, void (*fn)(void* ctx, int value), void* ctx);
+    void onWriteFloat(const String& name, void (*fn)(void* ctx, float value), void* ctx);
+    void onWriteBool(const String& name, void (*fn)(void* ctx, bool value), void* ctx);
+    void onWriteString(const String& name, void (*fn)(void* ctx, const String& value), void* ctx);
+    // callbacks fire only when a value from the server differs from the cached
+    // one, never for the device's own writes. deferred: changes are collected
+    // and callbacks run once the sync/push is applied (end of syncNow() and
+    // loop()), each with the latest value, so slow callbacks don't hold the
+    // connection open.
+    void setDeferredCallbacks(bool enabled);
 
     // manual sync
     bool syncNow();
 
+    // gateway mode: one client carries the sub-devices behind it (BLE,
+    // RS-485, ...), each with its own deviceKey, on the client's connection.
+    // their variables share the client's cache. as soon as a sub-device is
+    // added, heartbeat + sync become one POST /api/gateway/sync for the
+    // gateway and every sub-device, carrying all queued writes. sub-device
+    // writes always queue and go out with it (at the heartbeat interval, or
+    // sooner with setBatchWindow()). JSON only. returns an invalid SubDevice
+    // once 255 are in use.
+    SubDevice addDevice(const String& deviceKey);
+    size_t deviceCount() const { return devices.size(); }
+    bool gatewaySync();
+
+#if IOT_ENABLE_METRICS
+    // per-endpoint counts, latency, bytes, retries and failures since boot,
+    // plus the free-heap low-water mark
+    const ClientStats& getStats() const { return stats; }
+    void resetStats() { stats = ClientStats(); }
+    // add a summary to every heartbeat: "stats": { req, fail, retry, tx, rx, p50, p99, heap }.
+    // it also rides on wakeSync() and the gateway sync POST. with the adaptive
+    // heartbeat, whose pull is a bodiless GET, a heartbeat POST still goes out
+    // once per heartbeat interval to carry it
+    void setReportStats(bool enabled) { reportStats = enabled; }
+#endif
+
+#if defined(ESP32)
+    // run the client in its own FreeRTOS task pinned to `core` (0 leaves core 1
+    // to the sketch); don't call loop() afterwards. other tasks then go through
+    // handles only, declared before this call: reads are lock-free (a seqlock
+    // per variable; strings truncated to IOT_SHARED_STRING_SIZE - 1) and writes
+    // go through a lock-free queue of IOT_TASK_QUEUE_SIZE entries that the
+    // network task drains (write() returns false when it is full). the queue
+    // has a single producer, so only one other task may write. by-name calls,
+    // configuration and callbacks belong to the network task.
+    bool startTask(uint8_t core = 0, uint32_t stackSize = 8192, uint8_t priority = 1);
+#endif
+
     // helper
     bool isConnected();
 
 private:
+    friend class VarHandle;
+    friend class SubDevice;
+
     String deviceKey;
     String serverUrl;
 
+    // serverUrl split up for the raw-socket async path
+    String host;
+    uint16_t port = 80;
+    String basePath;
+    bool secure = false; // https:// URL
+
     WiFiClient wifiClient;
+#if IOT_ENABLE_TLS
+    WiFiClientSecure tlsClient;      // blocking path, kept alive
+    WiFiClientSecure tlsAsyncClient; // async path, one socket per request
+#if defined(ESP8266)
+    BearSSL::Session tlsSession;     // shared by both, so every reconnect resumes
+    std::unique_ptr<BearSSL::X509List> trustAnchors;
+#endif
+#endif
+    WiFiClient* net = &wifiClient;   // socket of the blocking path
     HTTPClient http;
 
     unsigned long lastHeartbeat = 0;
     unsigned long heartbeatInterval = 30000UL; // default 30s
 
-    std::vector<Variable> cache;
+    // firmware settings, brought back by a null directive in "config"
+    bool remoteConfig = true;
+    unsigned long localHeartbeat = 30000UL;
+    unsigned long localBatchWindow = 0;
+    unsigned long localBulkInterval = 10000UL;
+    WireFormat localWireFormat = WIRE_JSON;
+
+    bool adaptiveHeartbeat = false;
+    unsigned long lastContact = 0;     // millis() of the last answered request
+    unsigned long pollInterval = 30000UL;
+    unsigned long pollMin = 5000UL;
+    unsigned long pollMax = 300000UL;
+    unsigned long pollHint = 0;        // server-advertised poll interval, 0 = none
+    unsigned long changeCount = 0;     // incremented on every cache change
+
+    bool keepAlive = false;
+    unsigned long keepAliveIdle = 15000UL;
+    unsigned long lastRequest = 0;
+    unsigned long requestTimeout = 5000UL;
+    CircuitBreaker breaker;
 
+    typedef std::function<void(int status, const String& body)> RequestCallback;
+    struct AsyncRequest {
+        String endpoint;
+        String method;
+        String payload;
+        String ifNoneMatch;
+        int retries;
+        int attempts;
+        RequestCallback done;
+        unsigned long startedAt = 0; // first attempt, 0 = not sent yet
+        int slot = -1;               // single-variable write, so a newer value can replace it
+        bool critical = false;       // queued ahead of everything else
+    };
+    bool asyncMode = false;
+    bool asyncActive = false;          // front of asyncQueue is in flight
+    unsigned long asyncRetryAt = 0;    // earliest start of the next attempt
+    std::vector<AsyncRequest> asyncQueue;
+    static const size_t asyncQueueMax = 16;
+    static const size_t asyncCriticalReserve = 4; // extra room only critical writes may use
+    AsyncHttp asyncHttp;
+    ResultCallback heartbeatCb;
+    ResultCallback syncCb;
+    WriteResultCallback writeResultCb;
+
+    ITransportAdapter* transport = nullptr;
+    ITransportAdapter* pushTransport = nullptr;
+    unsigned long lastPushConnect = 0;
+
+    bool deltaSync = false;
+    String syncRevision;   // revision of the last applied variable list
+    const String noRevision; // If-None-Match when delta sync is off
+    String lastEtag;       // ETag header of the last response
+
+    WireFormat wireFormat = WIRE_JSON;
+    bool msgpackAccepted = false;    // server answers application/msgpack
+    bool lastBinary = false;         // body of the last response is MessagePack
+    std::vector<uint16_t> wireSlots; // variable id -> cache slot + 1 (0 = unknown)
+
+    bool compression = false;
+    bool deflateAccepted = false;    // server has answered Content-Encoding: deflate
+    bool deflateRejected = false;    // a compressed body got 415: requests stay plain
+    bool inflateShort = false;       // server's window exceeds ours: stop asking
+    std::unique_ptr<uint8_t[]> inflateWindow;
+
+    VariableCache cache;
+
+    struct GatewayDevice {
+        String key;
+        String revision; // delta sync, as syncRevision for the gateway itself
+    };
+    std::vector<GatewayDevice> devices; // index + 1 = Variable::device
+    int parseDevice = 0;                // device applyEntry() files entries under, -1 = skip them
+    VarValue scratch;                   // incoming value being parsed
+    String parseRevision;               // revision of the list being parsed
+    unsigned long entriesSkipped = 0;   // see skippedEntries()
+
+    // startTask(): values published for other tasks, one per declared slot,
+    // and the writes they queue
+    struct TaskWrite {
+        int slot = -1;
+        VarValue value;
+    };
+    bool taskMode = false;
+    std::unique_ptr<SeqlockValue[]> shared;
+    size_t sharedCount = 0;
+    SpscQueue<TaskWrite> taskWrites;
+#if defined(ESP32)
+    TaskHandle_t netTask = nullptr;
+    static void taskMain(void* self);
+#endif
+
+    unsigned long parseWait = 0; // how long nextToken() waits for data; 0 for in-memory bodies
+
+    char txBuf[IOT_TX_BUFFER_SIZE];
+    char rxBuf[IOT_RX_BUFFER_SIZE];
+    StaticJsonDocument<512> responseDoc; // reused for every small response (room for a batch's ids)
+
+    // indexed from Variable::callback
     struct CallbackEntry {
-        String name;
-        VarType type;
         IntCallback intCb;
         FloatCallback floatCb;
         BoolCallback boolCb;
         StringCallback stringCb;
     };
     std::vector<CallbackEntry> callbacks;
+    bool deferCallbacks = false;
+    std::vector<uint16_t> deferred; // slots with a queued callback, in change order
+
+    struct PendingWrite {
+        int slot;
+        VarValue value;
+        bool offline = false;  // taken while offline: `at` is sent as its age
+        unsigned long at = 0;
+    };
+    std::vector<PendingWrite> pending;
+    std::vector<PendingWrite> deviceWrites; // sub-device writes, for the next gateway sync
+    std::vector<PendingWrite> gatewaySent;  // buffer for the writes of a gateway sync in flight
+    bool batching = false;
+    unsigned long batchWindow = 0; // 0 = only explicit batches
+    unsigned long batchStarted = 0;
+
+    std::vector<PendingWrite> bulk; // PRIORITY_BULK writes, one per slot, oldest first
+    unsigned long bulkInterval = 10000UL;
+    size_t bulkMax = 20;
+    unsigned long lastBulkAt = 0;
+    bool bulkInFlight = false;
+
+    RingBuffer<PendingWrite> offlineQueue;
+    static const size_t drainBatch = 20;   // entries per replay request
+    bool drainInFlight = false;
+    size_t drainOverwritten = 0;           // entries overwritten while a drain was in flight
+    unsigned long nextDrainAt = 0;
+    unsigned long drainBackoff = 0;
+
+    struct Sample {
+        uint32_t ts = 0;
+        float v = 0.0f;
+    };
+    struct Series {
+        int slot = -1;
+        float resolution = 0.001f;
+        unsigned long flushMs = 1000;
+        unsigned long firstAt = 0;  // millis() when the oldest unsent sample came in
+        RingBuffer<Sample> buf;
+        bool inFlight = false;
+        size_t overwritten = 0;     // samples dropped while a chunk was in flight
+    };
+    std::vector<Series> series;
+
+    IStorageAdapter* storage = nullptr;
+    bool queueDirty = false;
+    unsigned long lastQueueSave = 0;
+
+    bool cacheLog = false;
+    bool logReady = false;            // restored; changes are recorded from now on
+    std::vector<uint16_t> logDirty;   // slots changed since the last flush
+    unsigned long logFlushMs = 2000UL;
+    size_t logCompactBytes = 4096;
+    unsigned long lastLogFlush = 0;
+    long logGen = -1;                 // generation of the current file, -1 = none yet
+    size_t logBytes = 0;              // size of the current file
+    size_t logLive = 0;               // its size right after the last compaction
+
+#if IOT_ENABLE_METRICS
+    ClientStats stats;
+    bool reportStats = false;
+    unsigned long lastStatsAt = 0; // adaptive heartbeat: last stats-only heartbeat
+    int statAttempts = 0;       // of the request in progress
+    size_t statReceived = 0;
+    void noteAttempt() { statAttempts++; }
+    void noteReceived(size_t n) { statReceived += n; }
+    void noteHeap();
+    void recordRequest(const String& endpoint, unsigned long ms, size_t sent, size_t received, int attempts, bool ok);
+    void addStats(JsonObject o);
+#else
+    void noteAttempt() {}
+    void noteReceived(size_t) {}
+    void noteHeap() {}
+#endif
+
+    bool sleepCycle = false;
+    bool holdWrites = false; // sleep cycle: writes wait in `pending` for wakeSync()
+    size_t snapBytes = 0;
 
     // low-level
-    String makeRequest(const String& endpoint, const String& method, const String& payload = "", int retries = 1);
+    // status (optional) receives the HTTP code of the last attempt; a 304 is
+    // returned as "" with *status == 304 and is not retried
+    String makeRequest(const String& endpoint, const String& method, const String& payload = "", int retries = 1,
+                       int* status = nullptr, const String& ifNoneMatch = "");
+    // sends `len` bytes of txBuf and reads the answer into rxBuf (NUL-terminated).
+    // returns the body length, 0 on failure
+    size_t requestBuffered(const String& endpoint, const char* method, size_t len, int retries = 1);
+    // consumes a response body from the socket; returns false on a parse error
+    typedef bool (IOTServerClient::*BodyParser)(Stream& in);
+    // shared by all: the body goes to `parser` when given, else into *out when
+    // given, otherwise into rxBuf. returns the body length (1 for a parser)
+    size_t performRequest(const String& endpoint, const char* method, const uint8_t* body, size_t len, int retries,
+                          int* status, const String& ifNoneMatch, String* out, BodyParser parser = nullptr);
+    size_t performAttempts(const String& endpoint, const char* method, const uint8_t* body, size_t len, int retries,
+                           int* status, const String& ifNoneMatch, String* out, BodyParser parser);
+    size_t readBody(char* buf, size_t cap);
+    uint8_t* inflateBuffer();
+    bool parseBody(Stream& in, BodyParser parser, bool inflate);
+    size_t inflateBody(const String& raw, String* out, char* buf, size_t cap);
+    void applyRequestTimeout(); // pushes requestTimeout down to the TLS handshake
+    size_t transportRequest(const String& endpoint, const char* method, const uint8_t* body, size_t len, int retries,
+                            int* status, const String& ifNoneMatch, String* out, BodyParser parser);
     String varTypeToString(VarType t);
-    VarType stringToVarType(const String& s);
-    void processUpdate(const String& name, const String& value, VarType type);
+    static const char* varTypeName(VarType t);
+    VarType stringToVarType(const String& s) { return stringToVarType(s.c_str()); }
+    static VarType stringToVarType(const char* s);
+    CallbackEntry* callbackFor(const String& name, VarType type, uint8_t device = 0);
+    CallbackEntry* callbackAt(int slot);
+    void dispatch(int slot);
+    void runDeferred();
     bool sendHeartbeat();
-    bool sendVariable(const String& name, const String& value, VarType type);
-    void updateCache(const String& name, const String& value, VarType type);
-    Variable* findInCache(const String& name);
+    bool sendVariable(int slot, const VarValue& value);
+    bool writeVariable(const String& name, const VarValue& value, uint8_t device = 0);
+    bool writeSlot(int slot, const VarValue& value);
+    void queueWrite(int slot, const VarValue& value);
+    std::vector<PendingWrite>& writesFor(int slot);
+    void requeueWrites(std::vector<PendingWrite>& writes);
+    void confirmQueued(std::vector<PendingWrite>& queue);
+    bool shouldSend(const Variable& v, const VarValue& value);
+    void queueOffline(int slot, const VarValue& value);
+    void supersedeOffline(int slot, const VarValue& value);
+    void drainOffline();
+    void drainDone(size_t n, bool ok);
+    void saveOfflineQueue();
+    void loadOfflineQueue();
+    void loadSnapshot();
+    void loadCacheLog();
+    size_t readCacheLog(const String& text, bool apply, long* gen, size_t* expect);
+    void appendLogLine(String& out, const Variable& v);
+    bool compactCacheLog();
+    void confirmWrite(int slot, const VarValue& value);
+    bool sendBatch();
+    void queueBulk(int slot, const VarValue& value);
+    void sendBulk();
+    void bulkDone(const std::vector<PendingWrite>& sent, bool ok);
+    bool uploadSeries(size_t index);
+    void seriesDone(size_t index, size_t n, bool ok);
+    void fillSeries(JsonDocument& doc, const Series& s, size_t n, bool binary);
+    bool postBatch(const std::vector<PendingWrite>& writes, int retries);
+
+    bool enqueueRequest(const String& endpoint, const String& method, const String& payload, int retries,
+                        RequestCallback done, const String& ifNoneMatch = "", bool critical = false,
+                        int slot = -1);
+    bool enqueueWrite(int slot, const VarValue& value, bool critical);
+    void pumpAsync();
+    void asyncAttemptFailed(int status);
+    void completeAsync(int status, const String& body);
+
+    String variablePayload(int slot, const VarValue& value);
+    size_t encodeVariable(int slot, const VarValue& value, char* out, size_t cap);
+    size_t encodeHeartbeat(char* out, size_t cap);
+    size_t serializeBody(JsonDocument& doc, char* out, size_t cap);
+    void packEntry(JsonObject o, int slot, const VarValue& value);
+    void learnId(int slot, unsigned id);
+    size_t batchDocSize(const std::vector<PendingWrite>& writes);
+    void fillBatch(JsonDocument& doc, const std::vector<PendingWrite>& writes, bool binary);
+    void fillWrite(JsonObject o, const PendingWrite& p, bool binary);
+    size_t gatewayDocSize(const std::vector<PendingWrite>& writes);
+    bool sendDeviceWrite(int slot, const VarValue& value);
+    void fillGateway(JsonDocument& doc, const std::vector<PendingWrite>& writes);
+    void batchSent(const std::vector<PendingWrite>& sent, bool ok);
+    int deviceIndex(const char* key) const;
+    bool applyGatewayStream(Stream& in);
+    bool applyDeviceArray(Stream& in);
+    String batchPayload(const std::vector<PendingWrite>& writes);
+    DeserializationError decodeResponse(JsonDocument& doc, const char* res, size_t len);
+    bool handleHeartbeatResponse(const char* res, size_t len);
+    bool handleVariableResponse(const char* res, size_t len);
+    bool handleHeartbeatResponse(const String& res) { return handleHeartbeatResponse(res.c_str(), res.length()); }
+    bool handleVariableResponse(const String& res) { return handleVariableResponse(res.c_str(), res.length()); }
+    bool handleSyncResponse(int status, const String& res);
+    void applyPollHint(unsigned long ms);
+    void applyConfig(JsonObjectConst c);
+    void applyVarConfig(const char* name, JsonVariantConst p);
+    bool readConfig(Stream& in);
+    void adaptPoll(bool changed);
+    bool applyVariables(const String& res);
+    bool applyVariableStream(Stream& in);
+    void handlePush(const String& payload);
+    void pumpPushTransport();
+    bool applyVariableArray(Stream& in);
+    bool applyPackedStream(Stream& in);
+    bool readEntry(Stream& in, JsonDocument& entry, bool packed);
+    void applyEntry(JsonObjectConst e);
+    int nextToken(Stream& in, bool consume = true);
+    bool readMember(Stream& in, JsonDocument& doc);
+    // remote = false for the device's own writes: cache only, no callback
+    void updateSlot(int slot, const VarValue& value, bool remote = true);
+    VarValue readShared(int slot) const;
+    bool postWrite(int slot, const VarValue& value);
+    void pumpTaskWrites();
+    Variable* findInCache(const String& name, uint8_t device = 0);
+};
+
+// One sub-device of a gateway, returned by IOTServerClient::addDevice(): the
+// client's variable API on the sub-device's own variables.
+class SubDevice {
+public:
+    SubDevice() {}
+    bool valid() const { return client != nullptr; }
+    const String& key() const;
+
+    bool virtualWrite(const String& name, int value);
+    bool virtualWrite(const String& name, float value);
+    bool virtualWrite(const String& name, bool value);
+    bool virtualWrite(const String& name, const String& value);
+
+    int virtualReadInt(const String& name);
+    float virtualReadFloat(const String& name);
+    bool virtualReadBool(const String& name);
+    String virtualReadString(const String& name);
+    size_t virtualReadString(const String& name, char* buf, size_t cap);
+
+    IntHandle declareInt(const String& name);
+    FloatHandle declareFloat(const String& name);
+    BoolHandle declareBool(const String& name);
+    StringHandle declareString(const String& name);
+
+    void onWriteInt(const String& name, IntCallback cb);
+    void onWriteFloat(const String& name, FloatCallback cb);
+    void onWriteBool(const String& name, BoolCallback cb);
+    void onWriteString(const String& name, StringCallback cb);
+
+private:
+    friend class IOTServerClient;
+    SubDevice(IOTServerClient* c, uint8_t d) : client(c), device(d) {}
+
+    IOTServerClient* client = nullptr;
+    uint8_t device = 0;
 };
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef ISTORAGEADAPTER_H
+#define ISTORAGEADAPTER_H
+
+#include <Arduino.h>
+
+// Key/value persistence used by IOTServerClient (offline queue, cache log, ...).
+// See LittleFsStorage.h for a ready-made implementation.
+class IStorageAdapter {
+public:
+    virtual ~IStorageAdapter() {}
+    virtual bool begin() = 0;
+    virtual bool saveString(const String& key, const String& value) = 0;
+    virtual String readString(const String& key) = 0;
+    virtual bool exists(const String& key) = 0;
+    virtual bool remove(const String& key) { return saveString(key, ""); }
+    // add value to the end of key's content. the default rewrites the whole
+    // value; adapters that can append in place should override it
+    virtual bool appendString(const String& key, const String& value) {
+        return saveString(key, readString(key) + value);
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef ITRANSPORTADAPTER_H
+#define ITRANSPORTADAPTER_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Transport used by IOTServerClient to talk to the server. Endpoints are the
+// HTTP paths of the server API ("/api/device/heartbeat", ...); adapters for
+// other protocols map them onto their own addressing.
+class ITransportAdapter {
+public:
+    // server -> device message; same JSON shape as GET /api/device/variables
+    // (often only the changed entries)
+    typedef std::function<void(const String& payload)> PushHandler;
+
+    struct Response {
+        int status = 0;   // HTTP-style status; <= 0 on transport error
+        String body;
+        String etag;
+    };
+
+    virtual ~ITransportAdapter() {}
+    // synchronous GET: returns response body or empty string
+    virtual String get(const String& endpoint, const String& headers = "") = 0;
+    // synchronous POST: returns response body or empty string
+    virtual String post(const String& endpoint, const String& body, const String& headers = "") = 0;
+    // full request as issued by IOTServerClient. headers: extra header lines,
+    // each terminated by "\r\n" (e.g. If-None-Match). the default maps onto
+    // get()/post() and reports 200 for a non-empty body; override it to pass
+    // real status codes and ETags (delta sync needs them)
+    virtual bool request(const String& method, const String& endpoint, const String& body,
+                         const String& headers, Response& out) {
+        out.body = method == "GET" ? get(endpoint, headers) : post(endpoint, body, headers);
+        out.status = out.body.length() > 0 ? 200 : 0;
+        return out.status > 0;
+    }
+    // called each loop (for adapters that need background handling)
+    virtual void loop() {}
+    // connect / initialize (optional)
+    virtual bool connect() { return true; }
+    virtual bool connected() { return true; }
+
+    // persistent transports that can deliver server-side changes as they
+    // happen call the handler from loop()
+    virtual bool supportsPush() const { return false; }
+    virtual void onPush(PushHandler handler) { push = handler; }
+
+protected:
+    PushHandler push;
+};
+
+#endif
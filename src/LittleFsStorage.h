@@ -0,0 +1,38 @@
+#ifndef LITTLEFS_STORAGE_H
+#define LITTLEFS_STORAGE_H
+
+// Header-only so the library builds without LittleFS unless a sketch includes it.
+#include "IStorageAdapter.h"
+#include <LittleFS.h>
+
+class LittleFsStorage : public IStorageAdapter {
+public:
+    bool begin() override { return LittleFS.begin(); }
+    bool saveString(const String& key, const String& value) override {
+        File f = LittleFS.open("/" + key, "w");
+        if (!f) return false;
+        f.print(value);
+        f.close();
+        return true;
+    }
+    String readString(const String& key) override {
+        if (!LittleFS.exists("/" + key)) return "";
+        File f = LittleFS.open("/" + key, "r");
+        if (!f) return "";
+        String s = f.readString();
+        f.close();
+        return s;
+    }
+    // opened for append, so only the new bytes are written
+    bool appendString(const String& key, const String& value) override {
+        File f = LittleFS.open("/" + key, "a");
+        if (!f) return false;
+        size_t n = f.print(value);
+        f.close();
+        return n == value.length();
+    }
+    bool exists(const String& key) override { return LittleFS.exists("/" + key); }
+    bool remove(const String& key) override { return !LittleFS.exists("/" + key) || LittleFS.remove("/" + key); }
+};
+
+#endif
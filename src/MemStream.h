@@ -0,0 +1,24 @@
+#ifndef MEM_STREAM_H
+#define MEM_STREAM_H
+
+#include <Arduino.h>
+
+// Read-only Stream over a memory buffer, so code written against a network
+// Stream can also consume a body that was already received into RAM.
+class MemStream : public Stream {
+public:
+    MemStream(const char* data, size_t len) : buf(data), size(len) {}
+
+    int available() override { return size - pos; }
+    int read() override { return pos < size ? (uint8_t)buf[pos++] : -1; }
+    int peek() override { return pos < size ? (uint8_t)buf[pos] : -1; }
+    size_t write(uint8_t) override { return 0; }
+    void flush() {}
+
+private:
+    const char* buf;
+    size_t size;
+    size_t pos = 0;
+};
+
+#endif
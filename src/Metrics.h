@@ -0,0 +1,93 @@
+#ifndef IOT_METRICS_H
+#define IOT_METRICS_H
+
+#include <Arduino.h>
+
+// Request statistics, collected when IOT_ENABLE_METRICS is 1.
+
+// Latency histogram with power-of-two buckets: bucket 0 holds 0-1 ms,
+// bucket i holds [2^i, 2^(i+1)) ms, the last one everything above.
+struct LatencyHistogram {
+    static const int buckets = 17; // last finite bucket ends at 65 s
+    uint32_t counts[buckets] = {};
+    uint32_t total = 0;
+
+    void add(unsigned long ms) {
+        int i = 0;
+        while (i < buckets - 1 && ms >= (2UL << i)) i++;
+        counts[i]++;
+        total++;
+    }
+
+    void merge(const LatencyHistogram& o) {
+        for (int i = 0; i < buckets; i++) counts[i] += o.counts[i];
+        total += o.total;
+    }
+
+    // estimate of the p-th percentile (ms), interpolated inside its bucket
+    unsigned long percentile(uint8_t p) const {
+        if (total == 0) return 0;
+        uint32_t rank = ((uint64_t)total * p + 99) / 100;
+        if (rank == 0) rank = 1;
+        uint32_t seen = 0;
+        for (int i = 0; i < buckets; i++) {
+            if (counts[i] == 0 || seen + counts[i] < rank) { seen += counts[i]; continue; }
+            unsigned long lo = i == 0 ? 0 : 1UL << i;
+            unsigned long hi = 2UL << i;
+            return lo + (hi - lo) * (rank - seen) / counts[i];
+        }
+        return 2UL << (buckets - 1);
+    }
+};
+
+enum StatsEndpoint { STATS_HEARTBEAT, STATS_VARIABLE, STATS_BATCH, STATS_PULL, STATS_SYNC, STATS_SERIES,
+                     STATS_OTHER, STATS_ENDPOINTS };
+
+struct EndpointStats {
+    uint32_t requests = 0;
+    uint32_t failures = 0;       // requests that got no usable answer
+    uint32_t retries = 0;        // attempts beyond the first
+    uint32_t bytesSent = 0;      // request bodies
+    uint32_t bytesReceived = 0;  // response bodies
+    LatencyHistogram latency;    // whole request, retries included
+    LatencyHistogram server;     // request sent -> first response byte (async socket path only)
+
+    unsigned long p50() const { return latency.percentile(50); }
+    unsigned long p99() const { return latency.percentile(99); }
+};
+
+struct ClientStats {
+    EndpointStats endpoints[STATS_ENDPOINTS];
+    uint32_t minFreeHeap = 0xFFFFFFFFUL; // lowest ESP.getFreeHeap() seen
+
+    const EndpointStats& operator[](StatsEndpoint e) const { return endpoints[e]; }
+    // all endpoints added up
+    EndpointStats total() const {
+        EndpointStats t;
+        for (const EndpointStats& e : endpoints) {
+            t.requests += e.requests;
+            t.failures += e.failures;
+            t.retries += e.retries;
+            t.bytesSent += e.bytesSent;
+            t.bytesReceived += e.bytesReceived;
+            t.latency.merge(e.latency);
+            t.server.merge(e.server);
+        }
+        return t;
+    }
+    static const char* name(StatsEndpoint e) {
+        static const char* names[] = { "heartbeat", "variable", "batch", "pull", "sync", "series", "other" };
+        return names[e];
+    }
+    static StatsEndpoint classify(const String& endpoint) {
+        if (endpoint.endsWith("/heartbeat")) return STATS_HEARTBEAT;
+        if (endpoint.endsWith("/variable")) return STATS_VARIABLE;
+        if (endpoint.endsWith("/batch")) return STATS_BATCH;
+        if (endpoint.endsWith("/variables")) return STATS_PULL;
+        if (endpoint.endsWith("/sync")) return STATS_SYNC;
+        if (endpoint.endsWith("/series")) return STATS_SERIES;
+        return STATS_OTHER;
+    }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MQTTADAPTER_H
+#define MQTTADAPTER_H
+
+// Header-only so the library builds without PubSubClient unless a sketch
+// includes this file.
+#include "ITransportAdapter.h"
+#include <PubSubClient.h>
+#include <WiFiClient.h>
+
+// MQTT transport (PubSubClient). Endpoints map onto topics under
+// devices/<deviceKey>, e.g. POST /api/device/heartbeat publishes to
+// devices/<deviceKey>/heartbeat.
+//
+// The server publishes variable changes to devices/<deviceKey>/variables
+// (retained, same JSON as GET /api/device/variables). They are handed to the
+// push handler as they arrive; get("/api/device/variables") returns the last one.
+class MqttAdapter : public ITransportAdapter {
+public:
+    MqttAdapter(Client& netClient, const char* broker, uint16_t port, const String& deviceKey,
+                uint16_t bufferSize = 1024)
+        : pubsub(netClient), host(broker), port(port), key(deviceKey), bufSize(bufferSize) {}
+
+    bool connect() override {
+        pubsub.setServer(host, port);
+        pubsub.setBufferSize(bufSize);
+        pubsub.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+            String msg;
+            msg.reserve(length);
+            for (unsigned int i = 0; i < length; i++) msg += (char)payload[i];
+            lastVarsPayload = msg;
+            lastVarsTag = String(++messages);
+            if (push) push(msg);
+        });
+        if (!pubsub.connected()) {
+            // the device key doubles as MQTT user name; the broker authenticates it
+            String clientId = "iot-" + key;
+            if (!pubsub.connect(clientId.c_str(), key.c_str(), nullptr)) return false;
+        }
+        return pubsub.subscribe(topic("/variables").c_str(), 1);
+    }
+
+    bool connected() override { return pubsub.connected(); }
+
+    String get(const String& endpoint, const String& headers = "") override {
+        // MQTT is not request-response: answer from the last retained message
+        return endpoint == "/api/device/variables" ? lastVarsPayload : String("");
+    }
+
+    String post(const String& endpoint, const String& body, const String& headers = "") override {
+        String base = "/api/device";
+        String path = endpoint.startsWith(base) ? endpoint.substring(base.length()) : endpoint;
+        if (!pubsub.publish(topic(path).c_str(), (const uint8_t*)body.c_str(), body.length())) return "";
+        return "{\"success\":true}";
+    }
+
+    bool request(const String& method, const String& endpoint, const String& body,
+                 const String& headers, Response& out) override {
+        if (method != "GET") {
+            out.body = post(endpoint, body, headers);
+            out.status = out.body.length() > 0 ? 200 : 0;
+            return out.status > 0;
+        }
+        out.body = get(endpoint, headers);
+        if (out.body.length() == 0) { out.status = 0; return false; }
+        // nothing new since the last pull: let delta sync skip the parse
+        bool same = headers.indexOf("If-None-Match: " + lastVarsTag + "\r\n") >= 0;
+        out.status = same ? 304 : 200;
+        out.etag = lastVarsTag;
+        if (same) out.body = "";
+        return true;
+    }
+
+    void loop() override { pubsub.loop(); }
+
+    bool supportsPush() const override { return true; }
+
+private:
+    PubSubClient pubsub;
+    const char* host;
+    uint16_t port;
+    String key;
+    uint16_t bufSize;
+    String lastVarsPayload;
+    String lastVarsTag;
+    unsigned long messages = 0;
+
+    String topic(const String& path) const { return "devices/" + key + path; }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <vector>
+
+// Bounded FIFO over storage allocated once by reset(). When full, push()
+// overwrites the oldest entry.
+template <typename T>
+class RingBuffer {
+public:
+    void reset(size_t capacity) {
+        buf.assign(capacity, T());
+        head = 0;
+        count = 0;
+    }
+
+    size_t capacity() const { return buf.size(); }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == buf.size(); }
+
+    // returns false if the oldest entry had to be dropped (or capacity is 0)
+    bool push(const T& v) {
+        if (buf.empty()) return false;
+        bool dropped = full();
+        buf[(head + count) % buf.size()] = v;
+        if (dropped) head = (head + 1) % buf.size();
+        else count++;
+        return !dropped;
+    }
+
+    // i = 0 is the oldest entry
+    T& at(size_t i) { return buf[(head + i) % buf.size()]; }
+    const T& at(size_t i) const { return buf[(head + i) % buf.size()]; }
+
+    void pop(size_t n = 1) {
+        if (n > count) n = count;
+        head = buf.empty() ? 0 : (head + n) % buf.size();
+        count -= n;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+private:
+    std::vector<T> buf;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+#endif
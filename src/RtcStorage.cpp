@@ -0,0 +1,104 @@
+#include "RtcStorage.h"
+#include <stddef.h>
+
+namespace {
+
+struct RtcArea {
+    uint32_t magic;
+    uint16_t used;
+    uint8_t data[IOT_RTC_STORAGE_SIZE];
+};
+
+const uint32_t rtcMagic = 0x494f5431; // "IOT1"
+
+#if defined(ESP32)
+// kept by the RTC domain through deep sleep, zeroed on power-up
+RTC_DATA_ATTR RtcArea area;
+#else
+// ESP8266: RAM copy of the RTC user memory, written back on every change.
+// elsewhere it only lasts until reset
+RtcArea area;
+#endif
+
+}
+
+bool RtcStorage::begin() {
+#if defined(ESP8266)
+    ESP.rtcUserMemoryRead(0, (uint32_t*)&area, sizeof(area));
+#endif
+    if (area.magic != rtcMagic || area.used > sizeof(area.data)) {
+        area.magic = rtcMagic;
+        area.used = 0;
+        return commit();
+    }
+    return true;
+}
+
+int RtcStorage::find(const String& key, size_t* len) {
+    size_t pos = 0;
+    while (pos + 3 <= area.used) {
+        size_t klen = area.data[pos];
+        size_t vlen = area.data[pos + 1] | (area.data[pos + 2] << 8);
+        size_t rec = 3 + klen + vlen;
+        if (klen == key.length() && memcmp(area.data + pos + 3, key.c_str(), klen) == 0) {
+            if (len) *len = rec;
+            return pos;
+        }
+        pos += rec;
+    }
+    return -1;
+}
+
+void RtcStorage::drop(int at, size_t len) {
+    memmove(area.data + at, area.data + at + len, area.used - at - len);
+    area.used -= len;
+}
+
+bool RtcStorage::saveString(const String& key, const String& value) {
+    size_t len = 0;
+    int at = find(key, &len);
+    size_t klen = key.length();
+    size_t vlen = value.length();
+    // checked before the old record goes, so a value that doesn't fit keeps it
+    if (klen > 255 || vlen > 0xffff || area.used - len + 3 + klen + vlen > sizeof(area.data)) return false;
+    if (at >= 0) drop(at, len);
+
+    uint8_t* p = area.data + area.used;
+    p[0] = klen;
+    p[1] = vlen & 0xff;
+    p[2] = vlen >> 8;
+    memcpy(p + 3, key.c_str(), klen);
+    memcpy(p + 3 + klen, value.c_str(), vlen);
+    area.used += 3 + klen + vlen;
+    return commit();
+}
+
+String RtcStorage::readString(const String& key) {
+    int at = find(key, nullptr);
+    if (at < 0) return "";
+    size_t klen = area.data[at];
+    size_t vlen = area.data[at + 1] | (area.data[at + 2] << 8);
+    String s;
+    s.reserve(vlen);
+    const char* v = (const char*)area.data + at + 3 + klen;
+    for (size_t i = 0; i < vlen; i++) s += v[i];
+    return s;
+}
+
+bool RtcStorage::remove(const String& key) {
+    size_t len = 0;
+    int at = find(key, &len);
+    if (at < 0) return true;
+    drop(at, len);
+    return commit();
+}
+
+bool RtcStorage::commit() {
+#if defined(ESP8266)
+    // whole 4-byte blocks up to the end of the used data
+    size_t n = (offsetof(RtcArea, data) + area.used + 3) & ~(size_t)3;
+    return ESP.rtcUserMemoryWrite(0, (uint32_t*)&area, n);
+#else
+    return true;
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef RTC_STORAGE_H
+#define RTC_STORAGE_H
+
+#include "IStorageAdapter.h"
+
+// bytes for all keys together; ESP8266 has 512 bytes of RTC user memory.
+// a sleep snapshot takes 3 + key bytes of record header, 8 + revision of its own,
+// and per variable 2 + name + 4 (number) or 4 + text (string), plus 2 with a
+// server id: 504 bytes hold roughly 25 numeric variables with 10-char names
+#ifndef IOT_RTC_STORAGE_SIZE
+#define IOT_RTC_STORAGE_SIZE 504
+#endif
+
+// IStorageAdapter over RTC memory: survives deep sleep (not a power cut),
+// costs no flash wear and is much faster to write than a file system.
+// Meant for the sleep snapshot; values are small.
+// Records are packed as [key length (1)][value length (2)][key][value].
+class RtcStorage : public IStorageAdapter {
+public:
+    bool begin() override;
+    bool saveString(const String& key, const String& value) override;
+    String readString(const String& key) override;
+    bool exists(const String& key) override { return find(key, nullptr) >= 0; }
+    bool remove(const String& key) override;
+
+private:
+    // offset of key's record, -1 if absent; *len receives the record length
+    int find(const String& key, size_t* len);
+    void drop(int at, size_t len);
+    bool commit();
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SHARED_STATE_H
+#define SHARED_STATE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include "VariableCache.h"
+
+// string values readable from other tasks are truncated to this size - 1
+#ifndef IOT_SHARED_STRING_SIZE
+#define IOT_SHARED_STRING_SIZE 32
+#endif
+
+// One variable's value published for lock-free reads from other tasks.
+// Single writer (the network task). The sequence number is odd while a store
+// is in progress; a reader retries until it sees the same even number before
+// and after its copy.
+struct SeqlockValue {
+    std::atomic<uint32_t> seq{0};
+    VarType type = STRING_TYPE;
+    union {
+        int32_t i;
+        float f;
+        bool b;
+    };
+    char s[IOT_SHARED_STRING_SIZE];
+
+    SeqlockValue() : i(0) { s[0] = 0; }
+
+    void store(const VarValue& v) {
+        uint32_t n = seq.load(std::memory_order_relaxed);
+        seq.store(n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        type = v.type;
+        i = v.i; // copies the whole union
+        if (v.type == STRING_TYPE) {
+            strncpy(s, v.s.c_str(), sizeof(s) - 1);
+            s[sizeof(s) - 1] = 0;
+        }
+        seq.store(n + 2, std::memory_order_release);
+    }
+
+    VarValue load() const {
+        VarType t;
+        int32_t raw;
+        char text[IOT_SHARED_STRING_SIZE];
+        uint32_t before, after;
+        int spins = 0;
+        do {
+            // a reader that outranks the writer on the same core has to
+            // block for a tick so the store can finish
+            if (++spins > 100) { delay(1); spins = 0; }
+            before = seq.load(std::memory_order_acquire);
+            t = type;
+            raw = i;
+            if (t == STRING_TYPE) memcpy(text, s, sizeof(text));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        VarValue v;
+        v.type = t;
+        v.i = raw;
+        if (t == STRING_TYPE) {
+            text[sizeof(text) - 1] = 0;
+            v.s = text;
+        }
+        return v;
+    }
+};
+
+// Lock-free single-producer/single-consumer FIFO with a fixed capacity.
+// push() from one task, pop() from one other task. One slot stays empty to
+// tell full from empty.
+template <typename T>
+class SpscQueue {
+public:
+    void reset(size_t capacity) {
+        buf.assign(capacity + 1, T());
+        head.store(0);
+        tail.store(0);
+    }
+
+    // false when full (nothing is overwritten)
+    bool push(const T& v) {
+        if (buf.empty()) return false;
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % buf.size();
+        if (next == head.load(std::memory_order_acquire)) return false;
+        buf[t] = v;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        out = buf[h];
+        buf[h] = T(); // release heap held by the entry (string values)
+        head.store((h + 1) % buf.size(), std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return buf.empty() ? 0 : buf.size() - 1; }
+
+private:
+    std::vector<T> buf;
+    std::atomic<size_t> head{0}; // next entry to pop, owned by the consumer
+    std::atomic<size_t> tail{0}; // next free entry, owned by the producer
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "VariableCache.h"
+
+VarValue VarValue::parse(const String& text, VarType type) {
+    VarValue v;
+    v.set(text.c_str(), type);
+    return v;
+}
+
+void VarValue::set(const char* text, VarType t) {
+    if (!text) text = "";
+    type = t;
+    switch (t) {
+        case INT_TYPE: i = atol(text); break;
+        case FLOAT_TYPE: f = atof(text); break;
+        case BOOLEAN_TYPE: b = strcasecmp(text, "true") == 0 || strcmp(text, "1") == 0; break;
+        default: s = text; break;
+    }
+}
+
+int32_t VarValue::asInt() const {
+    switch (type) {
+        case INT_TYPE: return i;
+        case FLOAT_TYPE: return (int32_t)f;
+        case BOOLEAN_TYPE: return b ? 1 : 0;
+        default: return s.toInt();
+    }
+}
+
+float VarValue::asFloat() const {
+    switch (type) {
+        case INT_TYPE: return (float)i;
+        case FLOAT_TYPE: return f;
+        case BOOLEAN_TYPE: return b ? 1.0f : 0.0f;
+        default: return s.toFloat();
+    }
+}
+
+bool VarValue::asBool() const {
+    switch (type) {
+        case INT_TYPE: return i != 0;
+        case FLOAT_TYPE: return f != 0.0f;
+        case BOOLEAN_TYPE: return b;
+        default: return s.equalsIgnoreCase("true") || s == "1";
+    }
+}
+
+String VarValue::toString() const {
+    switch (type) {
+        case INT_TYPE: return String(i);
+        case FLOAT_TYPE: return String(f, 6);
+        case BOOLEAN_TYPE: return b ? "true" : "false";
+        default: return s;
+    }
+}
+
+size_t VarValue::copyTo(char* buf, size_t cap) const {
+    if (cap == 0) return 0;
+    int n;
+    switch (type) {
+        case INT_TYPE: n = snprintf(buf, cap, "%ld", (long)i); break;
+        case FLOAT_TYPE: n = snprintf(buf, cap, "%.6f", f); break;
+        case BOOLEAN_TYPE: n = snprintf(buf, cap, "%s", b ? "true" : "false"); break;
+        default: n = snprintf(buf, cap, "%s", s.c_str()); break;
+    }
+    if (n < 0) n = 0;
+    return (size_t)n < cap ? n : cap - 1;
+}
+
+bool VarValue::operator==(const VarValue& o) const {
+    if (type != o.type) return false;
+    switch (type) {
+        case INT_TYPE: return i == o.i;
+        case FLOAT_TYPE: return f == o.f;
+        case BOOLEAN_TYPE: return b == o.b;
+        default: return s == o.s;
+    }
+}
+
+// FNV-1a over the device byte and the name
+uint32_t VariableCache::hashName(const char* name, uint8_t device) {
+    uint32_t h = (2166136261UL ^ device) * 16777619UL;
+    for (const char* p = name; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+void VariableCache::reserve(size_t n, size_t nameLen, size_t valueLen) {
+    if (n > 0xFFFF) n = 0xFFFF;
+    if (n < count) n = count;
+    vars.resize(n);
+    for (size_t i = count; i < n; i++) {
+        vars[i].name.reserve(nameLen);
+        vars[i].value.s.reserve(valueLen);
+    }
+    fixed = true;
+    size_t size = 16;
+    while (size < n * 2) size *= 2;
+    slots.assign(size, Slot{0, 0});
+    for (size_t i = 0; i < count; i++) place(hashName(vars[i].name.c_str(), vars[i].device), i + 1);
+}
+
+int VariableCache::find(const char* name, uint8_t device) const {
+    if (slots.empty()) return npos;
+    uint32_t h = hashName(name, device);
+    size_t mask = slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& s = slots[i];
+        if (s.pos == 0) return npos;
+        if (s.hash == h && vars[s.pos - 1].device == device && vars[s.pos - 1].name == name) return s.pos - 1;
+    }
+}
+
+int VariableCache::insert(const char* name, VarType type, uint8_t device) {
+    int h = find(name, device);
+    if (h != npos) return h;
+    if (count == vars.size()) {
+        if (fixed || count >= 0xFFFF) return npos;
+        vars.push_back(Variable());
+    }
+
+    // a reserved entry keeps its buffers
+    Variable& nv = vars[count++];
+    nv.name = name;
+    nv.value.type = type;
+    nv.device = device;
+
+    // keep the load factor at or below 1/2 so probe chains stay short
+    if (count * 2 > slots.size()) grow();
+    else place(hashName(name, device), count);
+    return count - 1;
+}
+
+void VariableCache::clear() {
+    if (fixed) {
+        // keep the entries and their buffers for reuse: each becomes a fresh
+        // Variable that takes over the old one's (emptied) strings
+        for (size_t i = 0; i < count; i++) {
+            Variable& v = vars[i];
+            v.name = "";
+            v.value.s = "";
+            Variable fresh;
+            fresh.name = std::move(v.name);
+            fresh.value.s = std::move(v.value.s);
+            v = std::move(fresh);
+        }
+        slots.assign(slots.size(), Slot{0, 0});
+    } else {
+        vars.clear();
+        slots.clear();
+    }
+    count = 0;
+}
+
+void VariableCache::place(uint32_t hash, uint16_t pos) {
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i].pos != 0) i = (i + 1) & mask;
+    slots[i].hash = hash;
+    slots[i].pos = pos;
+}
+
+void VariableCache::grow() {
+    size_t n = slots.empty() ? 16 : slots.size() * 2;
+    slots.assign(n, Slot{0, 0});
+    for (size_t i = 0; i < count; i++) place(hashName(vars[i].name.c_str(), vars[i].device), i + 1);
+}
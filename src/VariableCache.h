@@ -0,0 +1,118 @@
+#ifndef VARIABLE_CACHE_H
+#define VARIABLE_CACHE_H
+
+#include <Arduino.h>
+#include <vector>
+
+// public variable types
+enum VarType { INT_TYPE, FLOAT_TYPE, STRING_TYPE, BOOLEAN_TYPE };
+
+// Typed value: numbers and booleans are stored inline and converted once on
+// arrival; the String member is only used for STRING_TYPE.
+struct VarValue {
+    VarType type = STRING_TYPE;
+    union {
+        int32_t i;
+        float f;
+        bool b;
+    };
+    String s;
+
+    VarValue() : i(0) {}
+    static VarValue ofInt(int32_t v) { VarValue x; x.type = INT_TYPE; x.i = v; return x; }
+    static VarValue ofFloat(float v) { VarValue x; x.type = FLOAT_TYPE; x.f = v; return x; }
+    static VarValue ofBool(bool v) { VarValue x; x.type = BOOLEAN_TYPE; x.b = v; return x; }
+    static VarValue ofString(const String& v) { VarValue x; x.type = STRING_TYPE; x.s = v; return x; }
+    // convert wire text ("23.5", "true", ...) into the given type
+    static VarValue parse(const String& text, VarType type);
+    // same, in place: a string value reuses the buffer of s
+    void set(const char* text, VarType t);
+
+    int32_t asInt() const;
+    float asFloat() const;
+    bool asBool() const;
+    // wire text; floats use 6 decimals
+    String toString() const;
+    // the same text into buf (NUL-terminated, cut to cap - 1); returns its length
+    size_t copyTo(char* buf, size_t cap) const;
+
+    bool operator==(const VarValue& o) const;
+    bool operator!=(const VarValue& o) const { return !(*this == o); }
+};
+
+// When virtualWrite actually goes to the server.
+enum WriteMode { WRITE_ALWAYS, WRITE_ON_CHANGE, WRITE_DEADBAND };
+
+struct WritePolicy {
+    WriteMode mode = WRITE_ALWAYS;
+    float absDelta = 0.0f;          // WRITE_DEADBAND: send when |new - old| > absDelta
+    float pctDelta = 0.0f;          //   ... or > pctDelta % of |old|
+    unsigned long maxSilence = 0;   // send anyway after this long without a push (0 = never)
+};
+
+// Outbound scheduling class of a variable's writes.
+enum WritePriority { PRIORITY_CRITICAL, PRIORITY_NORMAL, PRIORITY_BULK };
+
+struct Variable {
+    String name;
+    VarValue value;
+    bool known = false;             // value has been set by a write or a sync
+    WritePolicy policy;
+    unsigned long lastPushAt = 0;   // millis() of the last accepted push
+    uint16_t wireId = 0;            // numeric id assigned by the server, 0 = none yet
+    uint16_t callback = 0;          // index + 1 of the client's callback entry, 0 = none
+    bool dispatchQueued = false;    // a deferred callback is waiting for this variable
+    uint8_t device = 0;             // gateway mode: sub-device index + 1, 0 = the client's own
+    uint8_t priority = PRIORITY_NORMAL;
+    bool logQueued = false;         // cache persistence: change not in the log yet
+};
+
+// Variable store with an open-addressing hash index on (device, name); in
+// gateway mode the variables of every sub-device share one store.
+// Entries are never removed, so a handle (index into the store) stays valid
+// for the lifetime of the cache even when the storage is reallocated.
+class VariableCache {
+public:
+    static const int npos = -1;
+
+    // fixed capacity: all n entries are built up front with reserved name and
+    // value buffers and the index is sized for them; insert() fails once they
+    // are used up, and nothing is allocated afterwards (strings that fit)
+    void reserve(size_t n, size_t nameLen, size_t valueLen);
+
+    // handle of name or npos
+    int find(const char* name, uint8_t device = 0) const;
+    int find(const String& name, uint8_t device = 0) const { return find(name.c_str(), device); }
+    // handle of name, appending a new entry if it is missing
+    int insert(const char* name, VarType type, uint8_t device = 0);
+    int insert(const String& name, VarType type, uint8_t device = 0) { return insert(name.c_str(), type, device); }
+
+    Variable& at(int handle) { return vars[handle]; }
+    const Variable& at(int handle) const { return vars[handle]; }
+    Variable* get(const String& name, uint8_t device = 0) {
+        int h = find(name, device);
+        return h == npos ? nullptr : &vars[h];
+    }
+
+    size_t size() const { return count; }
+    Variable* begin() { return vars.data(); }
+    Variable* end() { return vars.data() + count; }
+
+    void clear();
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint16_t pos; // handle + 1, 0 = empty
+    };
+    std::vector<Variable> vars; // the first `count` are in use
+    size_t count = 0;
+    bool fixed = false;
+    std::vector<Slot> slots; // size is 0 or a power of two
+
+    static uint32_t hashName(const char* name, uint8_t device);
+    void place(uint32_t hash, uint16_t pos);
+    void grow();
+};
+
+#endif